@@ -12,6 +12,27 @@
 #include <cstdint>
 #include <limits>
 #include <fstream>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <string>
+#include <filesystem>
+#include <unordered_map>
+#include <map>
+#include <cmath>
+#include <sstream>
+#include <ctime>
+
+#ifdef SHADER_HOT_RELOAD
+#include <shaderc/shaderc.hpp>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 //Chapter 3 and 4 includes
 #define GLM_FORCE_RADIANS
@@ -41,7 +62,16 @@ const uint32_t HEIGHT = 600;
 const std::string MODEL_PATH = "../models/viking_room.obj";
 const std::string TEXTURE_PATH = "../textures/viking_room.png";
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+//SPIR-V of shaders/shader.vert and shaders/shader.frag, compiled and optimised by glslc at build time (add_embedded_shaders in CMakeLists.txt)
+constexpr uint32_t VERT_SHADER_CODE[] = {
+#include "shader.vert.inc"
+};
+constexpr uint32_t FRAG_SHADER_CODE[] = {
+#include "shader.frag.inc"
+};
+
+//pipeline cache file, relative to the working directory like the model paths, written on shutdown and loaded on the next launch
+const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
 
 //List of validation layers to enable
 const std::vector<const char*> validationLayers = {
@@ -53,6 +83,15 @@ const std::vector<const char*> deviceExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+//simulated seconds per frame of the benchmark clock
+const float BENCHMARK_TIMESTEP = 1.0f / 60.0f;
+
+//longest an idle --on-demand loop sleeps without events, so shader reloads and finished pipeline compiles are still picked up
+const double IDLE_WAIT_TIMEOUT = 0.25;
+
+//offscreen colour images rendered in turn by headless runs, standing in for the swap chain images
+const uint32_t HEADLESS_IMAGE_COUNT = 2;
+
 //enable validation Layers if we're debugging
 #ifdef NDEBUG
     const bool enableValidationLayers = false;
@@ -146,138 +185,3310 @@ namespace std {
     };
 }
 
-//data inside uniform buffers
-struct UniformBufferObject {
-    alignas(16) glm::mat4 model;
-    alignas(16) glm::mat4 view;
-    alignas(16) glm::mat4 proj;
+//shader features picked per pipeline with specialization constants, must match the constant_id values in the shaders
+//and the bits of UniformBufferObject::featureFlags
+enum ShaderFeatureBits : uint32_t {
+    SHADER_FEATURE_TEXTURE = 1,
+    SHADER_FEATURE_VERTEX_COLOR = 2,
+    SHADER_FEATURE_DYNAMIC = 4,     //branch on ubo.featureFlags at runtime instead of specialising
+    SHADER_FEATURE_OBJECT_BUFFER = 8,   //read the model matrix from the dynamic object uniform buffer instead of push constants
 };
 
-class HelloTriangleApplication {
+//fixed function state and shader features that differ between graphics pipeline variants, everything else is shared by all of them
+struct PipelineKey {
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+    VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    VkBool32 blendEnable = VK_FALSE;
+    VkBool32 depthWriteEnable = VK_TRUE;
+    uint32_t shaderFeatures = SHADER_FEATURE_TEXTURE;
+
+    bool operator==(const PipelineKey& other) const {
+        return topology == other.topology && cullMode == other.cullMode && frontFace == other.frontFace &&
+               blendEnable == other.blendEnable && depthWriteEnable == other.depthWriteEnable && shaderFeatures == other.shaderFeatures;
+    }
+};
+
+namespace std {
+    template<> struct hash<PipelineKey> {
+        size_t operator()(PipelineKey const& key) const {
+            size_t seed = 0;
+            for (uint32_t value : {(uint32_t) key.topology, (uint32_t) key.cullMode, (uint32_t) key.frontFace, (uint32_t) key.blendEnable, (uint32_t) key.depthWriteEnable, key.shaderFeatures}) {
+                seed ^= hash<uint32_t>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            }
+            return seed;
+        }
+    };
+}
+
+//runtime settings, parsed from the command line in main
+struct AppSettings {
+    uint32_t framesInFlight = 2;    //frames the CPU may record ahead of the GPU, fewer lowers latency and more raises throughput
+    uint32_t swapchainImages = 0;   //requested swap chain image count, 0 picks minImageCount + 1
+    bool sweepFramesInFlight = false;   //measure throughput and latency for 1-4 frames in flight, then exit
+    uint32_t sweepFrames = 600;     //frames measured per configuration when sweeping or benchmarking
+    bool coldPipelineCache = false; //ignore the pipeline cache file on startup, it is still written on shutdown
+    bool benchmarkSpecialization = false;   //compare GPU time of specialised and uniform branching shader tiers, then exit
+    bool benchmarkDescriptors = false;      //measure descriptor set allocation cost per draw, then exit
+    bool benchmarkDrawScaling = false;      //measure CPU and GPU frame cost from 1 to 100k draws, then exit
+    bool objectDataInRing = false;  //per draw data from the dynamic uniform ring instead of push constants
+    uint32_t drawCount = 1;         //number of draws the model is split into, large values give a CPU bound stress scene
+    uint32_t recordThreads = 0;     //0 records on the main thread, otherwise number of workers recording secondary command buffers
+    bool cacheCommandBuffers = false;   //record once per frame slot and swap chain image and reuse until something structural changes
+    bool headless = false;          //render into offscreen images without a window, surface or swap chain
+    uint32_t frames = 0;            //frames rendered before exiting, 0 renders until the window is closed
+    std::string outputPath;         //headless only, the last frame is written to this file as a binary PPM
+    uint32_t width = WIDTH;         //window or offscreen image size
+    uint32_t height = HEIGHT;
+    std::string presentPolicy = "latency";      //present mode policy or single mode, see presentModePreference
+    bool benchmark = false;         //time settings.frames frames after a warm-up on a fixed clock, write the reports and exit
+    uint32_t warmupFrames = 60;     //frames drawn before the benchmark starts measuring
+    std::string scene = "model";    //named draw list preset, see applyScene
+    std::string benchmarkOutput = "benchmark";      //reports are written to <benchmarkOutput>.csv and .json
+    std::string gpuProfilePath = "gpu_profile.json";    //rolling GPU scope timings are written here on exit
+    std::string cpuTracePath = "cpu_trace.json";        //Chrome trace of the CPU_PROFILE_SCOPEs, only written when built with CPU_PROFILING
+    bool pipelineStatistics = false;    //count vertex, clipping, fragment and sample work of each frame with queries
+    std::string pipelineStatisticsPath = "pipeline_stats.json";     //per run report of the counters
+    bool benchmarkPipelineStatistics = false;   //measure the cost of the queries by rendering with and without them, then exit
+    uint32_t jobThreads = std::max(1u, std::thread::hardware_concurrency()) - 1;    //job system workers besides the main thread
+    bool benchmarkJobs = false;     //measure job spawn overhead and parallel-for scaling, then exit
+    bool onDemand = false;          //skip frames while nothing on screen changes, sleeping until the next event
+    bool animate = false;           //with onDemand, keep rendering because the model spins
+    bool singleThread = false;      //poll GLFW events and render on the main thread instead of a separate render thread
+    bool serialInit = false;        //run the initVulkan steps one after another instead of as a task graph, the startup baseline
+};
+
+//present mode names accepted on the command line
+const std::vector<std::pair<std::string, VkPresentModeKHR>> PRESENT_MODE_NAMES = {
+    {"immediate", VK_PRESENT_MODE_IMMEDIATE_KHR},
+    {"mailbox", VK_PRESENT_MODE_MAILBOX_KHR},
+    {"fifo", VK_PRESENT_MODE_FIFO_KHR},
+    {"fifo_relaxed", VK_PRESENT_MODE_FIFO_RELAXED_KHR}
+};
+
+std::string presentModeName(VkPresentModeKHR presentMode) {
+    for (const auto& [name, mode] : PRESENT_MODE_NAMES) {
+        if (mode == presentMode) {
+            return name;
+        }
+    }
+    return "unknown";
+}
+
+//present modes tried in order until the surface supports one, FIFO is always supported so every list ends with it
+const std::vector<std::pair<std::string, std::vector<VkPresentModeKHR>>> PRESENT_POLICIES = {
+    {"latency", {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR}},                                   //newest frame at each vblank, never tears
+    {"uncapped", {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR}},   //benchmarking, may tear
+    {"vsync", {VK_PRESENT_MODE_FIFO_KHR}},                                                                  //capped to the refresh rate, lowest power
+    {"relaxed", {VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR}}                               //capped, but a late frame tears instead of waiting
+};
+
+//preference list for a policy name, or for a single mode name which falls back to FIFO
+std::vector<VkPresentModeKHR> presentModePreference(const std::string& name) {
+    for (const auto& [policy, modes] : PRESENT_POLICIES) {
+        if (policy == name) {
+            return modes;
+        }
+    }
+    for (const auto& [modeName, mode] : PRESENT_MODE_NAMES) {
+        if (modeName == name) {
+            return {mode, VK_PRESENT_MODE_FIFO_KHR};
+        }
+    }
+    throw std::runtime_error("unknown present mode " + name + ", expected latency, uncapped, vsync, relaxed, immediate, mailbox, fifo or fifo_relaxed");
+}
+
+//scenes are presets of the draw list, so benchmark runs are named instead of described by their flags
+void applyScene(AppSettings& settings) {
+    if (settings.scene == "model") {
+        return;                     //the model as --draws draws, 1 by default
+    } else if (settings.scene == "split") {
+        settings.drawCount = 100;
+    } else if (settings.scene == "stress") {
+        settings.drawCount = 10000;
+    } else if (settings.scene == "stress-100k") {
+        settings.drawCount = 100000;
+    } else {
+        throw std::runtime_error("unknown scene " + settings.scene + ", expected model, split, stress or stress-100k");
+    }
+}
+
+//parse command line arguments into AppSettings
+AppSettings parseArguments(int argc, char* argv[]) {
+    AppSettings settings{};
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        auto nextValue = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("missing value for argument " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--frames-in-flight") {
+            settings.framesInFlight = std::max(1u, static_cast<uint32_t>(std::stoul(nextValue())));
+        } else if (arg == "--swapchain-images") {
+            settings.swapchainImages = static_cast<uint32_t>(std::stoul(nextValue()));
+        } else if (arg == "--sweep-frames-in-flight") {
+            settings.sweepFramesInFlight = true;
+        } else if (arg == "--sweep-frames") {
+            settings.sweepFrames = std::max(1u, static_cast<uint32_t>(std::stoul(nextValue())));
+        } else if (arg == "--object-data") {
+            std::string source = nextValue();
+            if (source != "push" && source != "ring") {
+                throw std::runtime_error("--object-data expects push or ring");
+            }
+            settings.objectDataInRing = source == "ring";
+        } else if (arg == "--benchmark-draw-scaling") {
+            settings.benchmarkDrawScaling = true;
+        } else if (arg == "--benchmark-descriptors") {
+            settings.benchmarkDescriptors = true;
+        } else if (arg == "--benchmark-specialization") {
+            settings.benchmarkSpecialization = true;
+        } else if (arg == "--cold-pipeline-cache") {
+            settings.coldPipelineCache = true;
+        } else if (arg == "--draws") {
+            settings.drawCount = std::max(1u, static_cast<uint32_t>(std::stoul(nextValue())));
+        } else if (arg == "--record-threads") {
+            settings.recordThreads = static_cast<uint32_t>(std::stoul(nextValue()));
+        } else if (arg == "--cache-commands") {
+            settings.cacheCommandBuffers = true;
+        } else if (arg == "--job-threads") {
+            settings.jobThreads = static_cast<uint32_t>(std::stoul(nextValue()));
+        } else if (arg == "--benchmark-jobs") {
+            settings.benchmarkJobs = true;
+        } else if (arg == "--on-demand") {
+            settings.onDemand = true;
+        } else if (arg == "--animate") {
+            settings.animate = true;
+        } else if (arg == "--single-thread") {
+            settings.singleThread = true;
+        } else if (arg == "--serial-init") {
+            settings.serialInit = true;
+        } else if (arg == "--headless") {
+            settings.headless = true;
+        } else if (arg == "--frames") {
+            settings.frames = static_cast<uint32_t>(std::stoul(nextValue()));
+        } else if (arg == "--output") {
+            settings.outputPath = nextValue();
+        } else if (arg == "--resolution") {
+            std::string value = nextValue();
+            size_t separator = value.find('x');
+            if (separator == std::string::npos) {
+                throw std::runtime_error("--resolution expects WIDTHxHEIGHT");
+            }
+            settings.width = std::max(1u, static_cast<uint32_t>(std::stoul(value.substr(0, separator))));
+            settings.height = std::max(1u, static_cast<uint32_t>(std::stoul(value.substr(separator + 1))));
+        } else if (arg == "--present-mode") {
+            settings.presentPolicy = nextValue();
+            presentModePreference(settings.presentPolicy);      //reject unknown names before any window opens
+        } else if (arg == "--benchmark") {
+            settings.benchmark = true;
+        } else if (arg == "--warmup") {
+            settings.warmupFrames = static_cast<uint32_t>(std::stoul(nextValue()));
+        } else if (arg == "--scene") {
+            settings.scene = nextValue();
+        } else if (arg == "--benchmark-output") {
+            settings.benchmarkOutput = nextValue();
+        } else if (arg == "--gpu-profile") {
+            settings.gpuProfilePath = nextValue();
+        } else if (arg == "--cpu-trace") {
+            settings.cpuTracePath = nextValue();
+        } else if (arg == "--pipeline-stats") {
+            settings.pipelineStatistics = true;
+        } else if (arg == "--pipeline-stats-output") {
+            settings.pipelineStatisticsPath = nextValue();
+        } else if (arg == "--benchmark-pipeline-stats") {
+            settings.pipelineStatistics = true;
+            settings.benchmarkPipelineStatistics = true;
+        } else {
+            throw std::runtime_error("unknown argument " + arg);
+        }
+    }
+
+    //ring offsets are handed out while recording, cached command buffers would keep pointing at data that is overwritten
+    if (settings.objectDataInRing && settings.cacheCommandBuffers) {
+        throw std::runtime_error("--object-data ring cannot be combined with --cache-commands");
+    }
+
+    applyScene(settings);
+
+    //nothing closes a headless run, so it always stops after a fixed number of frames
+    if (settings.benchmark && settings.frames == 0) {
+        settings.frames = 600;
+    }
+    if (settings.headless && settings.frames == 0) {
+        settings.frames = 300;
+    }
+    if (!settings.outputPath.empty() && !settings.headless) {
+        throw std::runtime_error("--output needs --headless, swap chain images cannot be read back");
+    }
+
+    return settings;
+}
+
+//accumulates min/average/max of a series of timings
+struct TimingStats {
+    double total = 0.0;
+    double min = std::numeric_limits<double>::max();
+    double max = 0.0;
+    uint64_t count = 0;
+
+    void add(double value) {
+        total += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+        count++;
+    }
+
+    double average() const {
+        return count > 0 ? total / count : 0.0;
+    }
+};
+
+//keeps every sample of a series, for the percentiles TimingStats cannot give
+struct SampleSeries {
+    std::vector<double> values;
+
+    void add(double value) {
+        values.push_back(value);
+    }
+
+    double mean() const {
+        double total = 0.0;
+        for (double value : values) {
+            total += value;
+        }
+        return values.empty() ? 0.0 : total / values.size();
+    }
+
+    double standardDeviation() const {
+        if (values.empty()) {
+            return 0.0;
+        }
+        double average = mean();
+        double squares = 0.0;
+        for (double value : values) {
+            squares += (value - average) * (value - average);
+        }
+        return std::sqrt(squares / values.size());
+    }
+
+    //nearest rank percentile, p between 0 and 100
+    double percentile(double p) const {
+        if (values.empty()) {
+            return 0.0;
+        }
+        std::vector<double> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    }
+};
+
+#ifdef CPU_PROFILING
+//one finished scope, in nanoseconds since CpuProfiler's epoch
+struct CpuTraceEvent {
+    const char* name;
+    int64_t start;
+    int64_t duration;
+};
+
+//events recorded by one thread in chunks allocated as they fill, only the owning thread appends so no lock is needed,
+//and the count is published with release ordering so a dump from another thread only reads complete events and chunks
+class CpuTraceBuffer {
     public:
+        static constexpr size_t CHUNK_SIZE = 4096;      //events per chunk, 96 KB
+        static constexpr size_t MAX_CHUNKS = 256;       //events after MAX_CHUNKS * CHUNK_SIZE are counted as dropped
+
+        CpuTraceBuffer(uint32_t threadId, std::string threadName, int64_t created)
+            : threadId(threadId), created(created), threadName(std::move(threadName)) {}
+
+        void add(const char* name, int64_t start, int64_t duration) {
+            size_t index = count.load(std::memory_order_relaxed);
+            if (index % CHUNK_SIZE == 0) {
+                if (index == MAX_CHUNKS * CHUNK_SIZE) {
+                    dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    return;
+                }
+                chunks[index / CHUNK_SIZE].reset(new CpuTraceEvent[CHUNK_SIZE]);
+            }
+            chunks[index / CHUNK_SIZE][index % CHUNK_SIZE] = {name, start, duration};
+            count.store(index + 1, std::memory_order_release);
+        }
 
-        //Called from main, starts everything
-        void run(){
-            initWindow();
-            initVulkan();
-            mainLoop();
-            cleanup();
+        //only below a count loaded with acquire ordering
+        const CpuTraceEvent& event(size_t index) const {
+            return chunks[index / CHUNK_SIZE][index % CHUNK_SIZE];
+        }
+
+        size_t allocatedBytes() const {
+            size_t events = count.load(std::memory_order_acquire);
+            return (events + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE * sizeof(CpuTraceEvent);
         }
 
+        const uint32_t threadId;
+        const int64_t created;                      //when the thread recorded its first event
+        std::string threadName;
+        std::atomic<size_t> count{0};
+        std::atomic<uint64_t> dropped{0};
+
     private:
-        GLFWwindow* window;
-        
-        VkInstance instance;
-        VkDebugUtilsMessengerEXT debugMessenger;
-        VkSurfaceKHR surface;
-        
-        VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-        VkDevice device;
+        std::array<std::unique_ptr<CpuTraceEvent[]>, MAX_CHUNKS> chunks;
+};
 
-        VkQueue graphicsQueue;
-        VkQueue presentQueue;
+//owns every thread's trace buffer, the mutex is only taken when a thread records its first event and when dumping
+class CpuProfiler {
+    public:
+        static CpuProfiler& instance() {
+            static CpuProfiler profiler;
+            return profiler;
+        }
 
-        VkSwapchainKHR swapChain;
-        std::vector<VkImage> swapChainImages;
-        VkFormat swapChainImageFormat;
-        VkExtent2D swapChainExtent;
-        std::vector<VkImageView> swapChainImageViews;
-        std::vector<VkFramebuffer> swapChainFramebuffers;
+        static int64_t now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - instance().epoch).count();
+        }
 
-        VkRenderPass renderPass;
-        VkDescriptorSetLayout descriptorSetLayout;
-        VkPipelineLayout pipelineLayout;
-        VkPipeline graphicsPipeline;
+        static void record(const char* name, int64_t start, int64_t duration) {
+            threadBuffer().add(name, start, duration);
+        }
 
-        VkCommandPool commandPool;
+        //name shown for the calling thread in the trace viewer
+        static void setThreadName(const char* name) {
+            CpuTraceBuffer& buffer = threadBuffer();
+            std::lock_guard<std::mutex> lock(instance().mutex);
+            buffer.threadName = name;
+        }
 
-        VkImage depthImage;
-        VkDeviceMemory depthImageMemory;
-        VkImageView depthImageView;
+        //scopes opened while paused record nothing and skip the clock reads, --benchmark pauses every other block of
+        //frames to measure what recording costs a frame
+        static void setPaused(bool paused) {
+            instance().paused.store(paused, std::memory_order_relaxed);
+        }
 
-        VkImage textureImage;
-        VkDeviceMemory textureImageMemory;
+        static bool isPaused() {
+            return instance().paused.load(std::memory_order_relaxed);
+        }
 
-        VkImageView textureImageView;
-        VkSampler textureSampler;
+        //write every recorded event in the Chrome trace event format, loadable in Perfetto or chrome://tracing
+        void writeChromeTrace(const std::string& path) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            std::ofstream file(path);
+            file << "{\"traceEvents\": [" << std::endl;
+            bool first = true;
+            for (const auto& buffer : buffers) {
+                file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->threadId
+                     << ", \"args\": {\"name\": \"" << buffer->threadName << "\"}}";
+                first = false;
+
+                size_t count = buffer->count.load(std::memory_order_acquire);
+                for (size_t i = 0; i < count; i++) {
+                    const CpuTraceEvent& event = buffer->event(i);
+                    file << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"ts\": " << event.start / 1000.0 << ", \"dur\": " << event.duration / 1000.0
+                         << ", \"pid\": 1, \"tid\": " << buffer->threadId << "}";
+                }
+            }
+            file << std::endl << "], \"displayTimeUnit\": \"ms\"}" << std::endl;
 
-        std::vector<Vertex> vertices;
-        std::vector<uint32_t> indices;
+            if (!file) {
+                throw std::runtime_error("failed to write " + path + "!");
+            }
+        }
 
-        VkBuffer vertexBuffer;
-        VkDeviceMemory vertexBufferMemory;
-        VkBuffer indexBuffer;
-        VkDeviceMemory indexBufferMemory;
+        struct ThreadStats {
+            uint32_t threadId;
+            std::string name;
+            uint64_t recorded;
+            uint64_t dropped;
+            int64_t lifetime;                       //nanoseconds from the thread's first event to the end of its last
+            size_t allocatedBytes;
+        };
+
+        //events recorded and dropped by each thread, with the span they were recorded over and the memory they take
+        std::vector<ThreadStats> threadStats() {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<ThreadStats> stats;
+            for (const auto& buffer : buffers) {
+                size_t count = buffer->count.load(std::memory_order_acquire);
+                int64_t end = count > 0 ? buffer->event(count - 1).start + buffer->event(count - 1).duration : buffer->created;
+                stats.push_back({buffer->threadId, buffer->threadName, count, buffer->dropped.load(std::memory_order_relaxed), end - buffer->created,
+                                 buffer->allocatedBytes()});
+            }
+            return stats;
+        }
 
-        std::vector<VkBuffer> uniformBuffers;
-        std::vector<VkDeviceMemory> uniformBuffersMemory;
-        std::vector<void*> uniformBuffersMapped;
+    private:
+        static CpuTraceBuffer& threadBuffer() {
+            thread_local CpuTraceBuffer* buffer = nullptr;
+            if (buffer == nullptr) {
+                CpuProfiler& profiler = instance();
+                std::lock_guard<std::mutex> lock(profiler.mutex);
+                uint32_t threadId = static_cast<uint32_t>(profiler.buffers.size());
+                profiler.buffers.push_back(std::make_unique<CpuTraceBuffer>(threadId, "thread " + std::to_string(threadId), now()));
+                buffer = profiler.buffers.back().get();
+            }
+            return *buffer;
+        }
 
-        VkDescriptorPool descriptorPool;
-        std::vector<VkDescriptorSet> descriptorSets;
+        const std::chrono::high_resolution_clock::time_point epoch = std::chrono::high_resolution_clock::now();
+        std::mutex mutex;
+        std::vector<std::unique_ptr<CpuTraceBuffer>> buffers;
+        std::atomic<bool> paused{false};
+};
 
-        std::vector<VkCommandBuffer> commandBuffers;
+//records the time between its construction and destruction as one trace event of the calling thread
+class CpuProfileScope {
+    public:
+        explicit CpuProfileScope(const char* name) : name(name), start(CpuProfiler::isPaused() ? PAUSED : CpuProfiler::now()) {}
 
-        std::vector<VkSemaphore> imageAvailableSemaphores;
-        std::vector<VkSemaphore> renderFinishedSemaphores;
-        std::vector<VkFence> inFlightFences;
-        uint32_t currentFrame = 0;
+        ~CpuProfileScope() {
+            if (start != PAUSED) {
+                CpuProfiler::record(name, start, CpuProfiler::now() - start);
+            }
+        }
+
+    private:
+        static constexpr int64_t PAUSED = -1;
+
+        const char* name;
+        int64_t start;
+};
+
+#define CPU_PROFILE_CONCAT_INNER(a, b) a##b
+#define CPU_PROFILE_CONCAT(a, b) CPU_PROFILE_CONCAT_INNER(a, b)
+#define CPU_PROFILE_SCOPE(name) CpuProfileScope CPU_PROFILE_CONCAT(cpuProfileScope, __LINE__)(name)
+#define CPU_PROFILE_FUNCTION() CPU_PROFILE_SCOPE(__func__)
+#define CPU_PROFILE_THREAD(name) CpuProfiler::setThreadName(name)
+#else
+//compiled out, configure with -DCPU_PROFILING=ON to record
+#define CPU_PROFILE_SCOPE(name)
+#define CPU_PROFILE_FUNCTION()
+#define CPU_PROFILE_THREAD(name) ((void) (name))
+#endif
+
+//fixed set of worker threads executing queued tasks, for long running background work (pipeline compiles, shader
+//reloads) that must not be picked up by a JobSystem::wait on the render loop
+class ThreadPool {
+    public:
+        //name labels the workers in CPU traces
+        explicit ThreadPool(uint32_t threadCount, const char* name = "worker") {
+            for (uint32_t i = 0; i < threadCount; i++) {
+                workers.emplace_back([this, name]() {
+                    CPU_PROFILE_THREAD(name);
+                    workerLoop();
+                });
+            }
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            condition.notify_all();
+
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+
+        //queue a task without waiting for it
+        void submit(std::function<void()> task) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push_back(std::move(task));
+            }
+            condition.notify_one();
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool stopping = false;
+
+        void workerLoop() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                    if (stopping && tasks.empty()) {
+                        return;
+                    }
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        }
+};
+
+//number of jobs not finished yet, a job spawned while another runs (spawnChild) adds to its parent's counter, so
+//waiting on a counter waits for the whole tree of jobs under it
+class JobCounter {
+    public:
+        bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+    private:
+        friend class JobSystem;
+
+        std::atomic<uint32_t> pending{0};
+        std::mutex errorMutex;
+        std::exception_ptr error;   //first exception thrown by a job, rethrown by JobSystem::wait
+};
+
+//one queued function and the counter it finishes
+struct Job {
+    std::function<void()> fn;
+    JobCounter* counter;
+};
+
+//fixed capacity Chase-Lev deque (Le et al. 2013), the owning thread pushes and pops at the bottom without locking and
+//any other thread steals from the top
+class WorkStealingDeque {
+    public:
+        static constexpr int64_t CAPACITY = 4096;
+
+        //owner only, false when full
+        bool push(Job* job) {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_acquire);
+            if (b - t >= CAPACITY) {
+                return false;
+            }
+
+            buffer[b & (CAPACITY - 1)].store(job, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        //owner only, newest job first
+        Job* pop() {
+            int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top.load(std::memory_order_relaxed);
+
+            if (t > b) {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            Job* job = buffer[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+            if (t == b) {
+                //last job, race the thieves for it
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    job = nullptr;
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return job;
+        }
+
+        //any thread, oldest job first
+        Job* steal() {
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom.load(std::memory_order_acquire);
+
+            if (t >= b) {
+                return nullptr;
+            }
+
+            Job* job = buffer[t & (CAPACITY - 1)].load(std::memory_order_acquire);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            return job;
+        }
+
+    private:
+        alignas(64) std::atomic<int64_t> top{0};
+        alignas(64) std::atomic<int64_t> bottom{0};
+        std::array<std::atomic<Job*>, CAPACITY> buffer{};
+};
+
+//work stealing job system, every worker and the thread that created it own a deque, idle threads steal from the others,
+//and a thread waiting on a counter runs jobs until it reaches zero instead of blocking
+class JobSystem {
+    public:
+        //workerCount threads are started, the creating thread is thread 0 and only runs jobs inside wait
+        explicit JobSystem(uint32_t workerCount) {
+            for (uint32_t i = 0; i <= workerCount; i++) {
+                deques.push_back(std::make_unique<WorkStealingDeque>());
+            }
+
+            previousSystem = currentSystem;
+            previousThread = currentThread;
+            currentSystem = this;
+            currentThread = 0;
+
+            for (uint32_t i = 1; i <= workerCount; i++) {
+                workers.emplace_back([this, i]() {
+                    CPU_PROFILE_THREAD("job worker");
+                    workerLoop(i);
+                });
+            }
+        }
+
+        //every counter must have been waited on, jobs still queued are not run
+        ~JobSystem() {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                stopping = true;
+            }
+            wake.notify_all();
+
+            for (auto& worker : workers) {
+                worker.join();
+            }
+
+            currentSystem = previousSystem;
+            currentThread = previousThread;
+        }
+
+        JobSystem(const JobSystem&) = delete;
+        JobSystem& operator=(const JobSystem&) = delete;
+
+        //workers plus the creating thread
+        uint32_t threadCount() const { return static_cast<uint32_t>(deques.size()); }
+
+        //move thread 0 and its deque to the calling thread, so a thread started after the system (the render thread) spawns
+        //without the injection lock, the old owner must have released it and every counter must have been waited on
+        void takeOwnership() {
+            currentSystem = this;
+            currentThread = 0;
+        }
+
+        //the calling thread stops owning deque 0, later spawns from it go through the injection queue
+        void releaseOwnership() {
+            if (currentSystem == this && currentThread == 0) {
+                currentSystem = nullptr;
+            }
+        }
+
+        //queue fn and count it in counter
+        void spawn(JobCounter& counter, std::function<void()> fn) {
+            counter.pending.fetch_add(1, std::memory_order_relaxed);
+            Job* job = new Job{std::move(fn), &counter};
+
+            if (currentSystem == this) {
+                if (!deques[currentThread]->push(job)) {
+                    execute(job);           //deque full, run it here rather than grow
+                    return;
+                }
+            } else {
+                std::lock_guard<std::mutex> lock(injectMutex);
+                injected.push_back(job);
+                injectedCount.fetch_add(1, std::memory_order_release);
+            }
+
+            if (sleepingWorkers.load(std::memory_order_seq_cst) > 0) {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                wakeups = std::min(wakeups + 1, sleepingWorkers.load(std::memory_order_relaxed));
+                wake.notify_one();
+            }
+        }
+
+        //queue fn as a child of the job running on this thread, its parent's counter only reaches zero after it
+        void spawnChild(std::function<void()> fn) {
+            if (currentCounter == nullptr) {
+                throw std::runtime_error("spawnChild called outside a job!");
+            }
+            spawn(*currentCounter, std::move(fn));
+        }
+
+        //run jobs until counter reaches zero, then rethrow the first exception a job under it threw
+        void wait(JobCounter& counter) {
+            while (!counter.done()) {
+                if (!runOne()) {
+                    std::this_thread::yield();
+                }
+            }
+
+            if (counter.error) {
+                std::exception_ptr error = counter.error;
+                counter.error = nullptr;
+                std::rethrow_exception(error);
+            }
+        }
+
+        //run one queued job on the calling thread, false when none could be found
+        bool runOne() {
+            Job* job = findJob();
+            if (job == nullptr) {
+                return false;
+            }
+            execute(job);
+            return true;
+        }
+
+        //call fn(begin, end) over [0, count) in ranges of at most grain, ranges are split in halves as child jobs so
+        //idle threads steal large pieces first, blocks (running jobs) until every range has finished
+        void parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)>& fn) {
+            JobCounter counter;
+            grain = std::max(1u, grain);
+            spawn(counter, [this, &fn, count, grain]() { splitRange(0, count, grain, fn); });
+            wait(counter);
+        }
+
+    private:
+        std::vector<std::unique_ptr<WorkStealingDeque>> deques;     //[thread], 0 belongs to the creating thread
+        std::vector<std::thread> workers;
+
+        std::mutex injectMutex;         //jobs spawned by threads outside the system
+        std::deque<Job*> injected;
+        std::atomic<uint32_t> injectedCount{0};
+
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        std::atomic<uint32_t> sleepingWorkers{0};
+        uint32_t wakeups = 0;
+        bool stopping = false;
+
+        JobSystem* previousSystem;
+        uint32_t previousThread;
+
+        static thread_local JobSystem* currentSystem;
+        static thread_local uint32_t currentThread;
+        static thread_local JobCounter* currentCounter;    //counter of the job running on this thread
+
+        void splitRange(uint32_t begin, uint32_t end, uint32_t grain, const std::function<void(uint32_t, uint32_t)>& fn) {
+            while (end - begin > grain) {
+                uint32_t middle = begin + (end - begin) / 2;
+                spawnChild([this, &fn, middle, end, grain]() { splitRange(middle, end, grain, fn); });
+                end = middle;
+            }
+            fn(begin, end);
+        }
+
+        //own deque first, then jobs from outside threads, then steal starting from a random thread
+        Job* findJob() {
+            if (currentSystem == this) {
+                if (Job* job = deques[currentThread]->pop()) {
+                    return job;
+                }
+            }
+
+            if (injectedCount.load(std::memory_order_acquire) > 0) {
+                std::lock_guard<std::mutex> lock(injectMutex);
+                if (!injected.empty()) {
+                    Job* job = injected.front();
+                    injected.pop_front();
+                    injectedCount.fetch_sub(1, std::memory_order_relaxed);
+                    return job;
+                }
+            }
+
+            static thread_local uint32_t random = 2463534242u;
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+
+            uint32_t count = threadCount();
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t victim = (random + i) % count;
+                if (currentSystem == this && victim == currentThread) {
+                    continue;
+                }
+                if (Job* job = deques[victim]->steal()) {
+                    return job;
+                }
+            }
+            return nullptr;
+        }
+
+        void execute(Job* job) {
+            JobCounter* counter = job->counter;
+            JobCounter* parentCounter = currentCounter;
+            currentCounter = counter;
+
+            try {
+                job->fn();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(counter->errorMutex);
+                if (!counter->error) {
+                    counter->error = std::current_exception();
+                }
+            }
+
+            currentCounter = parentCounter;
+            delete job;
+            counter->pending.fetch_sub(1, std::memory_order_acq_rel);     //the waiter may destroy counter from here on
+        }
+
+        //spin briefly when out of work, then sleep until a spawn wakes us, the timeout covers a wakeup racing the sleep
+        void workerLoop(uint32_t index) {
+            currentSystem = this;
+            currentThread = index;
+
+            uint32_t idleRounds = 0;
+            while (true) {
+                if (runOne()) {
+                    idleRounds = 0;
+                    continue;
+                }
+                if (++idleRounds < 64) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                if (stopping) {
+                    return;
+                }
+                sleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+                wake.wait_for(lock, std::chrono::milliseconds(1), [this]() { return wakeups > 0 || stopping; });
+                if (wakeups > 0) {
+                    wakeups--;
+                }
+                sleepingWorkers.fetch_sub(1, std::memory_order_relaxed);
+                idleRounds = 0;
+            }
+        }
+};
+
+thread_local JobSystem* JobSystem::currentSystem = nullptr;
+thread_local uint32_t JobSystem::currentThread = 0;
+thread_local JobCounter* JobSystem::currentCounter = nullptr;
+
+//--benchmark-jobs, cost of spawning and finishing an empty job compared with a mutex queue, and how parallelFor over
+//a compute bound loop scales from 1 thread to maxWorkers + 1
+void benchmarkJobSystem(uint32_t maxWorkers) {
+    using clock = std::chrono::high_resolution_clock;
+    //batches fit in one deque, a full deque runs the job inline and would be timed as a spawn
+    const uint32_t BATCH = static_cast<uint32_t>(WorkStealingDeque::CAPACITY);
+    const uint32_t BATCHES = 25;
+    const uint32_t SPAWN_JOBS = BATCH * BATCHES;
+
+    auto nanoseconds = [](clock::time_point start, clock::time_point end) {
+        return std::chrono::duration<double, std::nano>(end - start).count();
+    };
+
+    for (uint32_t workers : {0u, maxWorkers}) {
+        JobSystem jobs(workers);
+        JobCounter counter;
+
+        //time to queue the jobs and time from the last spawn until the wait returns, summed over the batches
+        double spawnTime = 0.0;
+        double runTime = 0.0;
+        for (uint32_t batch = 0; batch < BATCHES; batch++) {
+            auto start = clock::now();
+            for (uint32_t i = 0; i < BATCH; i++) {
+                jobs.spawn(counter, []() {});
+            }
+            auto spawned = clock::now();
+            jobs.wait(counter);
+            spawnTime += nanoseconds(start, spawned);
+            runTime += nanoseconds(spawned, clock::now());
+        }
+
+        //the same jobs spawned as children from inside one job per batch, so they go to a worker's own deque
+        double childSpawnTime = 0.0;
+        double childRunTime = 0.0;
+        for (uint32_t batch = 0; batch < BATCHES; batch++) {
+            clock::time_point spawned;
+            jobs.spawn(counter, [&]() {
+                auto start = clock::now();
+                for (uint32_t i = 0; i < BATCH; i++) {
+                    jobs.spawnChild([]() {});
+                }
+                spawned = clock::now();
+                childSpawnTime += nanoseconds(start, spawned);
+            });
+            jobs.wait(counter);
+            childRunTime += nanoseconds(spawned, clock::now());
+        }
+
+        std::cout << "job spawn, " << workers << " workers: " << spawnTime / SPAWN_JOBS << " ns per spawn, " << runTime / SPAWN_JOBS << " ns per job to run and wait, "
+                  << childSpawnTime / SPAWN_JOBS << " ns per child spawn, " << childRunTime / SPAWN_JOBS << " ns per child job to run and wait" << std::endl;
+    }
+
+    {
+        std::atomic<uint32_t> remaining{SPAWN_JOBS};
+        ThreadPool pool(std::max(1u, maxWorkers));
+        auto start = clock::now();
+        for (uint32_t i = 0; i < SPAWN_JOBS; i++) {
+            pool.submit([&remaining]() { remaining.fetch_sub(1, std::memory_order_relaxed); });
+        }
+        auto submitted = clock::now();
+        while (remaining.load(std::memory_order_relaxed) > 0) {
+            std::this_thread::yield();
+        }
+        std::cout << "thread pool, " << std::max(1u, maxWorkers) << " workers: " << nanoseconds(start, submitted) / SPAWN_JOBS << " ns per submit, "
+                  << nanoseconds(submitted, clock::now()) / SPAWN_JOBS << " ns per task to drain" << std::endl;
+    }
+
+    const uint32_t ELEMENTS = 1 << 22;
+    const uint32_t GRAIN = 4096;
+    const int REPEATS = 5;
+    std::vector<float> values(ELEMENTS);
+    for (uint32_t i = 0; i < ELEMENTS; i++) {
+        values[i] = static_cast<float>(i % 1000) * 0.001f;
+    }
+
+    //1, 2, 4, ... threads and finally every worker
+    std::vector<uint32_t> workerCounts;
+    for (uint32_t threads = 1; threads < maxWorkers + 1; threads *= 2) {
+        workerCounts.push_back(threads - 1);
+    }
+    workerCounts.push_back(maxWorkers);
+
+    double singleThreadTime = 0.0;
+    for (uint32_t workers : workerCounts) {
+        JobSystem jobs(workers);
+
+        //best of a few runs, the work per element is heavy enough that memory bandwidth does not cap the scaling
+        double best = std::numeric_limits<double>::max();
+        for (int repeat = 0; repeat < REPEATS; repeat++) {
+            std::vector<float> results(ELEMENTS);
+            auto start = clock::now();
+            jobs.parallelFor(ELEMENTS, GRAIN, [&](uint32_t first, uint32_t last) {
+                for (uint32_t i = first; i < last; i++) {
+                    float x = values[i];
+                    for (int k = 0; k < 16; k++) {
+                        x = std::sin(x) * 0.5f + std::sqrt(x + 1.0f);
+                    }
+                    results[i] = x;
+                }
+            });
+            best = std::min(best, std::chrono::duration<double, std::milli>(clock::now() - start).count());
+        }
+
+        if (workers == 0) {
+            singleThreadTime = best;
+        }
+        std::cout << "parallelFor, " << jobs.threadCount() << " threads: " << best << " ms, " << singleThreadTime / best << "x" << std::endl;
+    }
+}
+
+//tasks with dependencies, each task runs once every task it depends on has finished, so independent work overlaps
+class TaskGraph {
+    public:
+        using TaskId = size_t;
+
+        //dependencies have to be added before the tasks that need them, so insertion order is always a valid serial order
+        TaskId add(const char* name, std::function<void()> fn, const std::vector<TaskId>& dependencies = {}) {
+            TaskId id = tasks.size();
+            tasks.push_back({name, std::move(fn), static_cast<uint32_t>(dependencies.size()), {}, 0.0, 0.0});
+            for (TaskId dependency : dependencies) {
+                tasks[dependency].dependents.push_back(id);
+            }
+            return id;
+        }
+
+        //run every task as a job and return once all have finished, the calling thread runs jobs while it waits,
+        //after a task throws the tasks that have not started yet are skipped and the first exception is rethrown here
+        void run(JobSystem& jobs) {
+            start = std::chrono::high_resolution_clock::now();
+
+            std::vector<TaskId> ready;
+            for (TaskId id = 0; id < tasks.size(); id++) {
+                if (tasks[id].waitingOn == 0) {
+                    ready.push_back(id);
+                }
+            }
+            dispatch(jobs, ready);
+
+            //a task spawns its dependents before its own job finishes, so the counter only drains once every task has run
+            jobs.wait(taskJobs);
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        //run every task on the calling thread in insertion order
+        void runSerial() {
+            start = std::chrono::high_resolution_clock::now();
+            for (auto& task : tasks) {
+                task.started = elapsed();
+                task.fn();
+                task.finished = elapsed();
+            }
+        }
+
+        //the tasks that took longest, with when they started and finished relative to the start of the run
+        void printSlowest(size_t count) const {
+            std::vector<const Task*> sorted;
+            for (const auto& task : tasks) {
+                sorted.push_back(&task);
+            }
+            std::sort(sorted.begin(), sorted.end(), [](const Task* a, const Task* b) { return a->finished - a->started > b->finished - b->started; });
+
+            for (size_t i = 0; i < std::min(count, sorted.size()); i++) {
+                std::cout << "  " << sorted[i]->name << ": " << sorted[i]->finished - sorted[i]->started << " ms (" << sorted[i]->started << " - "
+                          << sorted[i]->finished << " ms)" << std::endl;
+            }
+        }
+
+    private:
+        struct Task {
+            const char* name;
+            std::function<void()> fn;
+            uint32_t waitingOn;             //dependencies that have not finished yet
+            std::vector<TaskId> dependents;
+            double started;                 //milliseconds since the run started
+            double finished;
+        };
+
+        std::vector<Task> tasks;
+        std::chrono::high_resolution_clock::time_point start;
+        std::mutex mutex;                   //guards waitingOn and error
+        JobCounter taskJobs;
+        std::exception_ptr error;
+
+        double elapsed() const {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        //hand ready tasks to the job system, called without the mutex since a full deque runs the job inline and its
+        //execute takes the mutex again
+        void dispatch(JobSystem& jobs, const std::vector<TaskId>& ready) {
+            for (TaskId id : ready) {
+                jobs.spawn(taskJobs, [this, &jobs, id]() { execute(jobs, id); });
+            }
+        }
+
+        void execute(JobSystem& jobs, TaskId id) {
+            Task& task = tasks[id];
+            bool failed;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                failed = error != nullptr;
+            }
+
+            task.started = elapsed();
+            if (!failed) {
+                try {
+                    task.fn();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+            }
+            task.finished = elapsed();
+
+            std::vector<TaskId> ready;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (TaskId dependent : task.dependents) {
+                    if (--tasks[dependent].waitingOn == 0) {
+                        ready.push_back(dependent);
+                    }
+                }
+            }
+            dispatch(jobs, ready);
+        }
+};
+
+//bounded single producer single consumer queue, push and pop are wait free and never block each other
+template<typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+    public:
+        //producer only, false when full
+        bool push(const T& value) {
+            size_t tail = writeIndex.load(std::memory_order_relaxed);
+            if (tail - readIndex.load(std::memory_order_acquire) == Capacity) {
+                return false;
+            }
+            items[tail & (Capacity - 1)] = value;
+            writeIndex.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        //consumer only
+        bool empty() const {
+            return readIndex.load(std::memory_order_relaxed) == writeIndex.load(std::memory_order_acquire);
+        }
+
+        //consumer only
+        std::optional<T> pop() {
+            size_t head = readIndex.load(std::memory_order_relaxed);
+            if (head == writeIndex.load(std::memory_order_acquire)) {
+                return std::nullopt;
+            }
+            T value = items[head & (Capacity - 1)];
+            readIndex.store(head + 1, std::memory_order_release);
+            return value;
+        }
+
+    private:
+        alignas(64) std::atomic<size_t> writeIndex{0};
+        alignas(64) std::atomic<size_t> readIndex{0};
+        std::array<T, Capacity> items{};
+};
+
+//input and window events, GLFW callbacks push them on the thread that polls and the render thread applies them
+struct WindowEvent {
+    enum class Type { Key, Resize, Move, Refresh };
+
+    Type type;
+    int key;                        //Key only
+    int action;
+    int width;                      //Resize only, framebuffer size in pixels
+    int height;
+};
+
+//transient command pool owned by one frame in flight, command buffers are handed out linearly and all of
+//them are recycled at once by resetting the pool after the frame's fence has signaled
+class FrameCommandPool {
+    public:
+        void create(VkDevice device, uint32_t queueFamilyIndex) {
+            this->device = device;
+
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create command pool!");
+            }
+        }
+
+        //frees every command buffer allocated from the pool
+        void destroy() {
+            vkDestroyCommandPool(device, pool, nullptr);
+        }
+
+        //returns every command buffer to the initial state, they are handed out again by allocate
+        void reset() {
+            if (vkResetCommandPool(device, pool, 0) != VK_SUCCESS) {
+                throw std::runtime_error("failed to reset command pool!");
+            }
+            primaryUsed = 0;
+            secondaryUsed = 0;
+        }
+
+        //next unused command buffer of the requested level, the pool only grows when a frame needs more buffers than any frame before
+        VkCommandBuffer allocate(VkCommandBufferLevel level) {
+            bool primary = level == VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            std::vector<VkCommandBuffer>& buffers = primary ? primaryBuffers : secondaryBuffers;
+            size_t& used = primary ? primaryUsed : secondaryUsed;
+
+            if (used == buffers.size()) {
+                VkCommandBufferAllocateInfo allocInfo{};
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.commandPool = pool;
+                allocInfo.level = level;
+                allocInfo.commandBufferCount = 1;
+
+                VkCommandBuffer commandBuffer;
+                if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to allocate command buffers!");
+                }
+                buffers.push_back(commandBuffer);
+            }
+
+            return buffers[used++];
+        }
+
+    private:
+        VkDevice device = VK_NULL_HANDLE;
+        VkCommandPool pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> primaryBuffers;
+        std::vector<VkCommandBuffer> secondaryBuffers;
+        size_t primaryUsed = 0;
+        size_t secondaryUsed = 0;
+};
+
+//queue of destroy requests that are held back until the GPU has finished the frame that last used the resource
+class DeletionQueue {
+    public:
+        //defer 'destroy' until frame 'lastUsedFrame' has completed, 'bytes' is the device memory kept alive until then
+        void push(uint64_t lastUsedFrame, VkDeviceSize bytes, std::function<void()>&& destroy) {
+            entries.push_back({lastUsedFrame, bytes, std::move(destroy)});
+            heldBytes += bytes;
+            totalDeferred++;
+        }
+
+        //run every destroy request whose frame has completed (requests are pushed in frame order)
+        void flush(uint64_t completedFrame) {
+            while (!entries.empty() && entries.front().frame <= completedFrame) {
+                entries.front().destroy();
+                heldBytes -= entries.front().bytes;
+                entries.pop_front();
+            }
+        }
+
+        //run every destroy request regardless of frame, only valid once the device is idle
+        void flushAll() {
+            flush(std::numeric_limits<uint64_t>::max());
+        }
+
+        size_t pendingDeletions() const { return entries.size(); }
+        VkDeviceSize bytesHeld() const { return heldBytes; }
+        uint64_t deferredTotal() const { return totalDeferred; }
+
+    private:
+        struct Entry {
+            uint64_t frame;
+            VkDeviceSize bytes;
+            std::function<void()> destroy;
+        };
+
+        std::deque<Entry> entries;
+        VkDeviceSize heldBytes = 0;
+        uint64_t totalDeferred = 0;
+};
+
+//min/average/max of a GPU scope over its most recent frames
+struct GpuScopeStats {
+    double min;
+    double average;
+    double max;
+    uint64_t frames;            //frames measured since the profiler was created, not only the recent ones
+};
+
+//named GPU timestamp scopes with a query pool per frame in flight, a frame's results are read back when its slot
+//comes round again, after the fence wait, so reading them never stalls the CPU on the GPU
+class GpuProfiler {
+    public:
+        static constexpr uint32_t MAX_SCOPES = 32;          //per frame, scopes beyond this are not timed
+        static constexpr uint32_t NO_SCOPE = std::numeric_limits<uint32_t>::max();
+        static constexpr size_t ROLLING_FRAMES = 120;       //frames the rolling statistics cover
+
+        //leaves the profiler disabled if the queue family cannot write timestamps
+        void create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t framesInFlight) {
+            this->device = device;
+
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+            timestampPeriod = properties.limits.timestampPeriod;
+
+            uint32_t queueFamilyCount = 0;
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+            std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+            vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+            uint32_t validBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+            if (validBits == 0) {
+                return;
+            }
+            timestampMask = validBits >= 64 ? std::numeric_limits<uint64_t>::max() : (uint64_t(1) << validBits) - 1;
+
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 2 * MAX_SCOPES;
+
+            frames.resize(framesInFlight);
+            for (auto& frame : frames) {
+                if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &frame.pool) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create timestamp query pool!");
+                }
+            }
+        }
+
+        //destroys the query pools, the statistics are kept
+        void destroy() {
+            for (auto& frame : frames) {
+                vkDestroyQueryPool(device, frame.pool, nullptr);
+            }
+            frames.clear();
+        }
+
+        bool enabled() const { return !frames.empty(); }
+
+        //reset the frame's queries, recorded before any scope of a primary command buffer
+        void beginCommandBuffer(VkCommandBuffer commandBuffer, uint32_t frame) {
+            if (!enabled()) {
+                return;
+            }
+            frames[frame].scopes.clear();
+            vkCmdResetQueryPool(commandBuffer, frames[frame].pool, 0, 2 * MAX_SCOPES);
+        }
+
+        //name must outlive the frame, scopes are meant to be named with string literals
+        uint32_t beginScope(VkCommandBuffer commandBuffer, uint32_t frame, const char* name) {
+            if (!enabled() || frames[frame].scopes.size() == MAX_SCOPES) {
+                return NO_SCOPE;
+            }
+            uint32_t scope = static_cast<uint32_t>(frames[frame].scopes.size());
+            frames[frame].scopes.push_back(name);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frames[frame].pool, 2 * scope);
+            return scope;
+        }
+
+        void endScope(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope) {
+            if (scope != NO_SCOPE) {
+                vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frames[frame].pool, 2 * scope + 1);
+            }
+        }
+
+        //the frame's command buffer was submitted, its results are collected the next time the slot is used
+        void submitted(uint32_t frame) {
+            if (enabled()) {
+                frames[frame].pending = true;
+            }
+        }
+
+        //read the scopes of the frame that last used this slot, call once its fence has signaled,
+        //returns each scope's time in milliseconds and adds it to the statistics
+        std::vector<std::pair<const char*, double>> collect(uint32_t frame) {
+            std::vector<std::pair<const char*, double>> times;
+            if (!enabled() || !frames[frame].pending) {
+                return times;
+            }
+            frames[frame].pending = false;
+
+            const std::vector<const char*>& scopes = frames[frame].scopes;
+            std::vector<uint64_t> timestamps(2 * scopes.size());
+            if (scopes.empty() || vkGetQueryPoolResults(device, frames[frame].pool, 0, static_cast<uint32_t>(timestamps.size()), timestamps.size() * sizeof(uint64_t),
+                                                        timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+                return times;
+            }
+
+            for (size_t i = 0; i < scopes.size(); i++) {
+                double milliseconds = ((timestamps[2 * i + 1] - timestamps[2 * i]) & timestampMask) * timestampPeriod / 1000000.0;
+                times.emplace_back(scopes[i], milliseconds);
+
+                ScopeHistory& scope = history[scopes[i]];
+                scope.recent.push_back(milliseconds);
+                if (scope.recent.size() > ROLLING_FRAMES) {
+                    scope.recent.pop_front();
+                }
+                scope.frames++;
+            }
+            return times;
+        }
+
+        //rolling statistics of a scope, empty if it has never been measured
+        std::optional<GpuScopeStats> stats(const std::string& name) const {
+            auto scope = history.find(name);
+            if (scope == history.end() || scope->second.recent.empty()) {
+                return std::nullopt;
+            }
+
+            GpuScopeStats stats{std::numeric_limits<double>::max(), 0.0, 0.0, scope->second.frames};
+            for (double milliseconds : scope->second.recent) {
+                stats.min = std::min(stats.min, milliseconds);
+                stats.max = std::max(stats.max, milliseconds);
+                stats.average += milliseconds;
+            }
+            stats.average /= scope->second.recent.size();
+            return stats;
+        }
+
+        std::vector<std::string> scopeNames() const {
+            std::vector<std::string> names;
+            for (const auto& entry : history) {
+                names.push_back(entry.first);
+            }
+            return names;
+        }
+
+        //{"scope": {"min_ms", "avg_ms", "max_ms", "frames"}, ...} over the rolling window
+        void writeJson(const std::string& path) const {
+            std::ofstream file(path);
+            file << "{" << std::endl;
+            size_t written = 0;
+            for (const auto& name : scopeNames()) {
+                GpuScopeStats scope = *stats(name);
+                file << "  \"" << name << "\": {\"min_ms\": " << scope.min << ", \"avg_ms\": " << scope.average << ", \"max_ms\": " << scope.max
+                     << ", \"frames\": " << scope.frames << "}" << (++written < history.size() ? "," : "") << std::endl;
+            }
+            file << "}" << std::endl;
+
+            if (!file) {
+                throw std::runtime_error("failed to write " + path + "!");
+            }
+        }
+
+    private:
+        struct FrameQueries {
+            VkQueryPool pool = VK_NULL_HANDLE;
+            std::vector<const char*> scopes;    //query 2 * i and 2 * i + 1 time scopes[i]
+            bool pending = false;
+        };
+
+        struct ScopeHistory {
+            std::deque<double> recent;
+            uint64_t frames = 0;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        float timestampPeriod = 0.0f;       //nanoseconds per timestamp tick
+        uint64_t timestampMask = 0;
+        std::vector<FrameQueries> frames;
+        std::map<std::string, ScopeHistory> history;
+};
+
+//times the commands recorded between its construction and destruction as one GpuProfiler scope
+class GpuScope {
+    public:
+        GpuScope(GpuProfiler& profiler, VkCommandBuffer commandBuffer, uint32_t frame, const char* name)
+            : profiler(profiler), commandBuffer(commandBuffer), frame(frame), scope(profiler.beginScope(commandBuffer, frame, name)) {}
+
+        ~GpuScope() {
+            profiler.endScope(commandBuffer, frame, scope);
+        }
+
+    private:
+        GpuProfiler& profiler;
+        VkCommandBuffer commandBuffer;
+        uint32_t frame;
+        uint32_t scope;
+};
+
+//statistics counted by the pipeline statistics query, results are written in ascending bit order which is the order of PIPELINE_COUNTER_NAMES
+const VkQueryPipelineStatisticFlags PIPELINE_STATISTICS =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT | VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+//the pipeline statistics followed by the occlusion query's samples passed
+const std::array<const char*, 7> PIPELINE_COUNTER_NAMES = {
+    "input_assembly_vertices", "input_assembly_primitives", "vertex_shader_invocations", "clipping_invocations",
+    "clipping_primitives", "fragment_shader_invocations", "samples_passed"
+};
+
+using PipelineCounters = std::array<uint64_t, PIPELINE_COUNTER_NAMES.size()>;
+
+//a pipeline statistics and an occlusion query around each frame's render pass, one of each per frame in flight,
+//read back when the slot comes round again like GpuProfiler so the CPU never waits on them
+class PipelineStatisticsQueries {
+    public:
+        void create(VkDevice device, uint32_t framesInFlight, bool precise) {
+            this->device = device;
+            this->precise = precise;
+
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+            queryPoolInfo.queryCount = framesInFlight;
+            queryPoolInfo.pipelineStatistics = PIPELINE_STATISTICS;
+
+            if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &statisticsPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create pipeline statistics query pool!");
+            }
+
+            queryPoolInfo.queryType = VK_QUERY_TYPE_OCCLUSION;
+            queryPoolInfo.pipelineStatistics = 0;
+
+            if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &occlusionPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create occlusion query pool!");
+            }
+
+            pending.assign(framesInFlight, false);
+        }
+
+        void destroy() {
+            if (statisticsPool != VK_NULL_HANDLE) {
+                vkDestroyQueryPool(device, statisticsPool, nullptr);
+                vkDestroyQueryPool(device, occlusionPool, nullptr);
+                statisticsPool = VK_NULL_HANDLE;
+                occlusionPool = VK_NULL_HANDLE;
+            }
+            pending.clear();
+        }
+
+        bool enabled() const { return statisticsPool != VK_NULL_HANDLE; }
+
+        //recorded outside the render pass, queries begun there may span it
+        void begin(VkCommandBuffer commandBuffer, uint32_t frame) {
+            vkCmdResetQueryPool(commandBuffer, statisticsPool, frame, 1);
+            vkCmdResetQueryPool(commandBuffer, occlusionPool, frame, 1);
+            vkCmdBeginQuery(commandBuffer, statisticsPool, frame, 0);
+            vkCmdBeginQuery(commandBuffer, occlusionPool, frame, precise ? VK_QUERY_CONTROL_PRECISE_BIT : 0);
+        }
+
+        void end(VkCommandBuffer commandBuffer, uint32_t frame) {
+            vkCmdEndQuery(commandBuffer, occlusionPool, frame);
+            vkCmdEndQuery(commandBuffer, statisticsPool, frame);
+        }
+
+        //secondary command buffers executed while the queries are active have to declare them
+        void inherit(VkCommandBufferInheritanceInfo& inheritanceInfo) const {
+            inheritanceInfo.occlusionQueryEnable = VK_TRUE;
+            inheritanceInfo.queryFlags = precise ? VK_QUERY_CONTROL_PRECISE_BIT : 0;
+            inheritanceInfo.pipelineStatistics = PIPELINE_STATISTICS;
+        }
+
+        //the frame's command buffer was submitted with the queries recorded
+        void submitted(uint32_t frame) {
+            pending[frame] = true;
+        }
+
+        //counters of the frame that last used this slot, call once its fence has signaled
+        std::optional<PipelineCounters> collect(uint32_t frame) {
+            if (!enabled() || !pending[frame]) {
+                return std::nullopt;
+            }
+            pending[frame] = false;
+
+            PipelineCounters counters{};
+            const size_t statisticCount = counters.size() - 1;
+            if (vkGetQueryPoolResults(device, statisticsPool, frame, 1, statisticCount * sizeof(uint64_t), counters.data(), statisticCount * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS ||
+                vkGetQueryPoolResults(device, occlusionPool, frame, 1, sizeof(uint64_t), &counters.back(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+                return std::nullopt;
+            }
+            return counters;
+        }
+
+    private:
+        VkDevice device = VK_NULL_HANDLE;
+        VkQueryPool statisticsPool = VK_NULL_HANDLE;
+        VkQueryPool occlusionPool = VK_NULL_HANDLE;
+        bool precise = false;           //exact sample counts, otherwise the occlusion query may only report zero or non-zero
+        std::vector<bool> pending;      //frame slot has results waiting to be read back
+};
+
+//graphics pipelines keyed by their state, a miss is compiled on a worker thread and VK_NULL_HANDLE is returned
+//until it is ready, so the render loop never waits on the driver's shader compiler
+class PipelineRegistry {
+    public:
+        void create(VkDevice device, uint32_t threadCount, std::function<VkPipeline(const PipelineKey&)> compile) {
+            this->device = device;
+            this->compile = std::move(compile);
+            compileThreads = std::make_unique<ThreadPool>(threadCount, "pipeline compiler");
+        }
+
+        //waits for compiles still in flight, then destroys every pipeline
+        void destroy() {
+            compileThreads.reset();
+
+            for (auto& entry : entries) {
+                if (entry.second.pipeline != VK_NULL_HANDLE) {
+                    vkDestroyPipeline(device, entry.second.pipeline, nullptr);
+                }
+            }
+            for (auto& replacement : replacements) {
+                vkDestroyPipeline(device, replacement.second, nullptr);
+            }
+            entries.clear();
+            replacements.clear();
+        }
+
+        //register a pipeline that was built up front, the registry takes ownership
+        void insert(const PipelineKey& key, VkPipeline pipeline) {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries[key].pipeline = pipeline;
+        }
+
+        //keys of every pipeline requested so far, including ones still compiling
+        std::vector<PipelineKey> keys() {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            std::vector<PipelineKey> result;
+            for (auto& entry : entries) {
+                result.push_back(entry.first);
+            }
+            return result;
+        }
+
+        //hand over a rebuilt pipeline, it replaces the current one at the next applyReplacements call
+        void queueReplacement(const PipelineKey& key, VkPipeline pipeline) {
+            std::lock_guard<std::mutex> lock(mutex);
+            replacements.emplace_back(key, pipeline);
+        }
+
+        //swap rebuilt pipelines in between frames, swapped is called with each replaced pipeline (VK_NULL_HANDLE
+        //if the key had not finished compiling) and the caller is responsible for retiring it once the GPU is done
+        void applyReplacements(const std::function<void(const PipelineKey&, VkPipeline, VkPipeline)>& swapped) {
+            std::vector<std::pair<PipelineKey, VkPipeline>> ready;
+            std::vector<VkPipeline> oldPipelines;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ready.swap(replacements);
+                for (auto& replacement : ready) {
+                    oldPipelines.push_back(entries[replacement.first].pipeline);
+                    entries[replacement.first].pipeline = replacement.second;
+                }
+            }
+
+            for (size_t i = 0; i < ready.size(); i++) {
+                swapped(ready[i].first, oldPipelines[i], ready[i].second);
+            }
+        }
+
+        //returns the pipeline for key, or VK_NULL_HANDLE while it is compiling or if compiling it failed
+        VkPipeline request(const PipelineKey& key) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto it = entries.find(key);
+            if (it != entries.end()) {
+                if (it->second.pipeline == VK_NULL_HANDLE) {
+                    fallbackRequests++;
+                }
+                return it->second.pipeline;
+            }
+
+            entries.emplace(key, Entry{});
+            fallbackRequests++;
+
+            auto requested = std::chrono::high_resolution_clock::now();
+            compileThreads->submit([this, key, requested]() {
+                auto compileStart = std::chrono::high_resolution_clock::now();
+
+                VkPipeline pipeline = VK_NULL_HANDLE;
+                try {
+                    pipeline = compile(key);
+                } catch (const std::exception& e) {
+                    std::cerr << "pipeline compile failed: " << e.what() << std::endl;
+                }
+
+                auto compileEnd = std::chrono::high_resolution_clock::now();
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (entries[key].pipeline != VK_NULL_HANDLE) {
+                    //a rebuild with newer shaders replaced it while this compile ran, this one was never bound
+                    vkDestroyPipeline(device, pipeline, nullptr);
+                    return;
+                }
+                entries[key].pipeline = pipeline;
+                if (pipeline == VK_NULL_HANDLE) {
+                    failedCompiles++;
+                    return;
+                }
+                compileTimings.add(std::chrono::duration<double, std::milli>(compileEnd - compileStart).count());
+                readyTimings.add(std::chrono::duration<double, std::milli>(compileEnd - requested).count());
+            });
+
+            return VK_NULL_HANDLE;
+        }
+
+        void printStats() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (compileTimings.count == 0 && failedCompiles == 0) {
+                return;
+            }
+
+            std::cout << "pipeline registry: " << entries.size() << " pipelines, " << compileTimings.count << " background compiles ("
+                      << failedCompiles << " failed), compile avg " << compileTimings.average() << " ms (max " << compileTimings.max
+                      << "), request to ready avg " << readyTimings.average() << " ms" << std::endl;
+            std::cout << "pipeline registry: " << compileTimings.count << " hitches avoided, " << compileTimings.total
+                      << " ms of compilation kept off the render loop, " << fallbackRequests << " requests served by the fallback" << std::endl;
+        }
+
+    private:
+        struct Entry {
+            VkPipeline pipeline = VK_NULL_HANDLE;   //stays VK_NULL_HANDLE while compiling and after a failed compile
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        std::function<VkPipeline(const PipelineKey&)> compile;
+        std::unique_ptr<ThreadPool> compileThreads;
+
+        std::mutex mutex;
+        std::unordered_map<PipelineKey, Entry> entries;
+        std::vector<std::pair<PipelineKey, VkPipeline>> replacements;
+        TimingStats compileTimings;     //time spent inside vkCreateGraphicsPipelines and shader module creation
+        TimingStats readyTimings;       //time from the first request until the pipeline could be bound
+        uint32_t failedCompiles = 0;
+        uint64_t fallbackRequests = 0;
+};
+
+//SPIR-V words of the shaders every graphics pipeline is built from
+struct ShaderBinaries {
+    std::vector<uint32_t> vert;
+    std::vector<uint32_t> frag;
+};
+
+//descriptor bindings, push constants and vertex inputs of one or more shader stages, read back from SPIR-V
+struct ShaderInterface {
+    VkShaderStageFlags stages = 0;
+    std::map<uint32_t, std::vector<VkDescriptorSetLayoutBinding>> sets;     //bindings of each descriptor set, sorted by binding
+    std::vector<VkPushConstantRange> pushConstantRanges;
+    std::vector<VkVertexInputAttributeDescription> vertexInputs;           //location and format only, binding and offset are left 0
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> uniformBlockSizes;   //bytes of each uniform buffer block, by set and binding
+
+    //true if both need the same descriptor set and pipeline layouts
+    bool sameLayout(const ShaderInterface& other) const {
+        auto sameBinding = [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+            return a.binding == b.binding && a.descriptorType == b.descriptorType && a.descriptorCount == b.descriptorCount && a.stageFlags == b.stageFlags;
+        };
+        auto sameRange = [](const VkPushConstantRange& a, const VkPushConstantRange& b) {
+            return a.stageFlags == b.stageFlags && a.offset == b.offset && a.size == b.size;
+        };
+
+        if (sets.size() != other.sets.size() || pushConstantRanges.size() != other.pushConstantRanges.size()) {
+            return false;
+        }
+        for (auto& set : sets) {
+            auto otherSet = other.sets.find(set.first);
+            if (otherSet == other.sets.end() || !std::equal(set.second.begin(), set.second.end(), otherSet->second.begin(), otherSet->second.end(), sameBinding)) {
+                return false;
+            }
+        }
+        return std::equal(pushConstantRanges.begin(), pushConstantRanges.end(), other.pushConstantRanges.begin(), sameRange) &&
+               uniformBlockSizes == other.uniformBlockSizes;
+    }
+
+    //combine the interfaces of two stages, a binding used by both must be declared the same way in each
+    void merge(const ShaderInterface& other) {
+        stages |= other.stages;
+
+        for (auto& set : other.sets) {
+            auto& bindings = sets[set.first];
+            for (auto& binding : set.second) {
+                auto existing = std::find_if(bindings.begin(), bindings.end(), [&](const VkDescriptorSetLayoutBinding& b) { return b.binding == binding.binding; });
+                if (existing == bindings.end()) {
+                    bindings.push_back(binding);
+                } else if (existing->descriptorType != binding.descriptorType || existing->descriptorCount != binding.descriptorCount) {
+                    throw std::runtime_error("descriptor set " + std::to_string(set.first) + " binding " + std::to_string(binding.binding) + " is declared differently between shader stages!");
+                } else {
+                    existing->stageFlags |= binding.stageFlags;
+                }
+            }
+            std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+        }
+
+        //the stages share the buffer, a block declared with different members would read it at different offsets
+        for (auto& [binding, size] : other.uniformBlockSizes) {
+            auto existing = uniformBlockSizes.find(binding);
+            if (existing == uniformBlockSizes.end()) {
+                uniformBlockSizes[binding] = size;
+            } else if (existing->second != size) {
+                throw std::runtime_error("uniform block at set " + std::to_string(binding.first) + " binding " + std::to_string(binding.second) + " is " +
+                                         std::to_string(existing->second) + " bytes in one shader stage and " + std::to_string(size) + " in another!");
+            }
+        }
+
+        //one range covering every stage keeps the layout simple, stages may read any part of it
+        for (auto& range : other.pushConstantRanges) {
+            if (pushConstantRanges.empty()) {
+                pushConstantRanges.push_back(range);
+            } else {
+                pushConstantRanges[0].stageFlags |= range.stageFlags;
+                pushConstantRanges[0].size = std::max(pushConstantRanges[0].offset + pushConstantRanges[0].size, range.offset + range.size) - pushConstantRanges[0].offset;
+                pushConstantRanges[0].offset = std::min(pushConstantRanges[0].offset, range.offset);
+            }
+        }
+
+        vertexInputs.insert(vertexInputs.end(), other.vertexInputs.begin(), other.vertexInputs.end());
+    }
+};
+
+//minimal SPIR-V reader, walks the instruction stream once and only understands the instructions that describe the shader interface
+ShaderInterface reflectSpirv(const std::vector<uint32_t>& code) {
+    const uint32_t SPIRV_MAGIC = 0x07230203;
+    if (code.size() < 5 || code[0] != SPIRV_MAGIC) {
+        throw std::runtime_error("invalid SPIR-V module!");
+    }
+
+    //everything we need to know about a result id
+    struct SpirvId {
+        uint32_t opcode = 0;
+        std::vector<uint32_t> operands;     //instruction operands without the result id
+        uint32_t set = 0;
+        uint32_t binding = UINT32_MAX;
+        uint32_t location = UINT32_MAX;
+        uint32_t arrayStride = 0;
+        bool builtIn = false;
+        bool block = false;
+        bool bufferBlock = false;
+        std::vector<uint32_t> memberOffsets;
+        std::vector<uint32_t> memberMatrixStrides;
+    };
+    std::vector<SpirvId> ids(code[3]);      //word 3 of the header is the id bound
+    ShaderInterface shaderInterface;
+
+    auto id = [&](uint32_t index) -> SpirvId& {
+        if (index >= ids.size()) {
+            throw std::runtime_error("invalid SPIR-V module!");
+        }
+        return ids[index];
+    };
+
+    for (size_t i = 5; i < code.size();) {
+        uint32_t opcode = code[i] & 0xffff;
+        uint32_t wordCount = code[i] >> 16;
+        if (wordCount == 0 || i + wordCount > code.size()) {
+            throw std::runtime_error("invalid SPIR-V module!");
+        }
+        const uint32_t* operands = &code[i + 1];
+        uint32_t operandCount = wordCount - 1;
+
+        switch (opcode) {
+            case 15: {  //OpEntryPoint
+                const VkShaderStageFlagBits executionModels[] = {VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+                    VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT, VK_SHADER_STAGE_GEOMETRY_BIT, VK_SHADER_STAGE_FRAGMENT_BIT, VK_SHADER_STAGE_COMPUTE_BIT};
+                if (operands[0] < 6) {
+                    shaderInterface.stages |= executionModels[operands[0]];
+                }
+                break;
+            }
+            case 71: {  //OpDecorate
+                SpirvId& target = id(operands[0]);
+                uint32_t value = operandCount > 2 ? operands[2] : 0;
+                switch (operands[1]) {
+                    case 2: target.block = true; break;
+                    case 3: target.bufferBlock = true; break;
+                    case 6: target.arrayStride = value; break;
+                    case 11: target.builtIn = true; break;
+                    case 30: target.location = value; break;
+                    case 33: target.binding = value; break;
+                    case 34: target.set = value; break;
+                }
+                break;
+            }
+            case 72: {  //OpMemberDecorate
+                SpirvId& target = id(operands[0]);
+                uint32_t member = operands[1];
+                uint32_t value = operandCount > 3 ? operands[3] : 0;
+                if (target.memberOffsets.size() <= member) {
+                    target.memberOffsets.resize(member + 1, 0);
+                    target.memberMatrixStrides.resize(member + 1, 0);
+                }
+                switch (operands[2]) {
+                    case 7: target.memberMatrixStrides[member] = value; break;
+                    case 11: target.builtIn = true; break;
+                    case 35: target.memberOffsets[member] = value; break;
+                }
+                break;
+            }
+            case 21: case 22: case 23: case 24: case 25: case 26: case 27: case 28: case 29: case 30: case 32: {  //OpType*
+                id(operands[0]).opcode = opcode;
+                id(operands[0]).operands.assign(operands + 1, operands + operandCount);
+                break;
+            }
+            case 43: case 59: {     //OpConstant, OpVariable
+                id(operands[1]).opcode = opcode;
+                id(operands[1]).operands = {operands[0]};
+                id(operands[1]).operands.insert(id(operands[1]).operands.end(), operands + 2, operands + operandCount);
+                break;
+            }
+        }
+
+        i += wordCount;
+    }
+
+    //byte size of a type as laid out in a buffer, structs use their member offsets
+    std::function<uint32_t(uint32_t, uint32_t)> typeSize = [&](uint32_t typeId, uint32_t matrixStride) -> uint32_t {
+        SpirvId& type = id(typeId);
+        switch (type.opcode) {
+            case 21: case 22: return type.operands[0] / 8;  //OpTypeInt, OpTypeFloat
+            case 23: return typeSize(type.operands[0], 0) * type.operands[1];   //OpTypeVector
+            case 24: return (matrixStride > 0 ? matrixStride : typeSize(type.operands[0], 0)) * type.operands[1];  //OpTypeMatrix
+            case 28: {  //OpTypeArray
+                uint32_t length = id(type.operands[1]).operands.at(1);
+                return (type.arrayStride > 0 ? type.arrayStride : typeSize(type.operands[0], 0)) * length;
+            }
+            case 30: {  //OpTypeStruct
+                if (type.operands.empty()) {
+                    return 0;
+                }
+                size_t last = type.operands.size() - 1;
+                uint32_t offset = last < type.memberOffsets.size() ? type.memberOffsets[last] : 0;
+                uint32_t stride = last < type.memberMatrixStrides.size() ? type.memberMatrixStrides[last] : 0;
+                return offset + typeSize(type.operands[last], stride);
+            }
+        }
+        throw std::runtime_error("unsupported type in SPIR-V shader interface!");
+    };
+
+    for (size_t variableId = 0; variableId < ids.size(); variableId++) {
+        SpirvId& variable = ids[variableId];
+        if (variable.opcode != 59) {
+            continue;
+        }
+
+        SpirvId& pointer = id(variable.operands[0]);
+        uint32_t storageClass = variable.operands[1];
+        uint32_t typeId = pointer.operands[1];
+
+        uint32_t descriptorCount = 1;
+        while (id(typeId).opcode == 28) {
+            descriptorCount *= id(id(typeId).operands[1]).operands.at(1);
+            typeId = id(typeId).operands[0];
+        }
+        SpirvId& type = id(typeId);
+
+        if (storageClass == 0 || storageClass == 2 || storageClass == 12) {     //UniformConstant, Uniform, StorageBuffer
+            VkDescriptorSetLayoutBinding binding{};
+            binding.binding = variable.binding;
+            binding.descriptorCount = descriptorCount;
+            binding.stageFlags = shaderInterface.stages;
+
+            if (type.opcode == 27) {
+                binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            } else if (type.opcode == 26) {
+                binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+            } else if (type.opcode == 25) {
+                //OpTypeImage operands: sampled type, dim, depth, arrayed, multisampled, sampled, format
+                if (type.operands[1] == 6) {
+                    binding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+                } else {
+                    binding.descriptorType = type.operands[5] == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+                }
+            } else if (storageClass == 12 || type.bufferBlock) {
+                binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            } else if (type.block) {
+                binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                shaderInterface.uniformBlockSizes[{variable.set, variable.binding}] = typeSize(typeId, 0);
+            } else {
+                continue;
+            }
+
+            if (variable.binding == UINT32_MAX) {
+                throw std::runtime_error("shader resource without a binding decoration!");
+            }
+            shaderInterface.sets[variable.set].push_back(binding);
+        } else if (storageClass == 9) {     //PushConstant
+            VkPushConstantRange range{};
+            range.stageFlags = shaderInterface.stages;
+            range.offset = 0;
+            range.size = typeSize(typeId, 0);
+            shaderInterface.pushConstantRanges.push_back(range);
+        } else if (storageClass == 1 && (shaderInterface.stages & VK_SHADER_STAGE_VERTEX_BIT) && !variable.builtIn && !type.builtIn) {    //Input
+            uint32_t componentCount = type.opcode == 23 ? type.operands[1] : 1;
+            SpirvId& component = type.opcode == 23 ? id(type.operands[0]) : type;
+            if ((component.opcode != 21 && component.opcode != 22) || component.operands[0] != 32 || componentCount > 4) {
+                throw std::runtime_error("unsupported vertex input type at location " + std::to_string(variable.location) + "!");
+            }
+
+            const VkFormat floatFormats[] = {VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+            const VkFormat intFormats[] = {VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT};
+            const VkFormat uintFormats[] = {VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT};
+
+            VkVertexInputAttributeDescription input{};
+            input.location = variable.location;
+            if (component.opcode == 22) {
+                input.format = floatFormats[componentCount - 1];
+            } else {
+                input.format = component.operands[1] ? intFormats[componentCount - 1] : uintFormats[componentCount - 1];
+            }
+            shaderInterface.vertexInputs.push_back(input);
+        }
+    }
+
+    for (auto& set : shaderInterface.sets) {
+        std::sort(set.second.begin(), set.second.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+    }
+
+    return shaderInterface;
+}
+
+//descriptor set layouts and pipeline layouts keyed by their contents, asking twice for the same layout returns the same handle
+class DescriptorLayoutCache {
+    public:
+        void create(VkDevice device) {
+            this->device = device;
+        }
+
+        void destroy() {
+            for (auto& layout : pipelineLayouts) {
+                vkDestroyPipelineLayout(device, layout.second, nullptr);
+            }
+            for (auto& layout : setLayouts) {
+                vkDestroyDescriptorSetLayout(device, layout.second, nullptr);
+            }
+            pipelineLayouts.clear();
+            setLayouts.clear();
+        }
+
+        VkDescriptorSetLayout getSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+            std::vector<uint32_t> key;
+            for (auto& binding : bindings) {
+                key.insert(key.end(), {binding.binding, (uint32_t) binding.descriptorType, binding.descriptorCount, (uint32_t) binding.stageFlags});
+            }
+
+            auto it = setLayouts.find(key);
+            if (it != setLayouts.end()) {
+                return it->second;
+            }
+
+            VkDescriptorSetLayoutCreateInfo layoutInfo{};
+            layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+            layoutInfo.pBindings = bindings.data();
+
+            VkDescriptorSetLayout layout;
+            if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create descriptor set layout!");
+            }
+
+            setLayouts.emplace(key, layout);
+            return layout;
+        }
+
+        VkPipelineLayout getPipelineLayout(const std::vector<VkDescriptorSetLayout>& layouts, const std::vector<VkPushConstantRange>& pushConstantRanges) {
+            std::vector<uint32_t> rangeKey;
+            for (auto& range : pushConstantRanges) {
+                rangeKey.insert(rangeKey.end(), {(uint32_t) range.stageFlags, range.offset, range.size});
+            }
+            auto key = std::make_pair(layouts, rangeKey);
+
+            auto it = pipelineLayouts.find(key);
+            if (it != pipelineLayouts.end()) {
+                return it->second;
+            }
+
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(layouts.size());
+            pipelineLayoutInfo.pSetLayouts = layouts.data();
+            pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+            pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.data();
+
+            VkPipelineLayout layout;
+            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create pipeline layout!");
+            }
+
+            pipelineLayouts.emplace(key, layout);
+            return layout;
+        }
+
+    private:
+        VkDevice device = VK_NULL_HANDLE;
+        std::map<std::vector<uint32_t>, VkDescriptorSetLayout> setLayouts;
+        std::map<std::pair<std::vector<VkDescriptorSetLayout>, std::vector<uint32_t>>, VkPipelineLayout> pipelineLayouts;
+};
+
+//linear sub-allocator over one persistently mapped buffer with a region per frame in flight, offsets are aligned to
+//minUniformBufferOffsetAlignment so each allocation can be bound as a dynamic uniform buffer offset
+class UniformRing {
+    public:
+        void create(void* mapped, VkDeviceSize frameSize, VkDeviceSize alignment) {
+            this->mapped = static_cast<char*>(mapped);
+            this->frameSize = frameSize;
+            this->alignment = alignment;
+        }
+
+        //start handing out the region of this frame, the GPU must be done with its previous contents
+        void beginFrame(uint32_t frame) {
+            frameBase = frame * frameSize;
+            head = 0;
+            bytesWritten = 0;
+        }
+
+        //copy data into the ring and return its offset from the start of the buffer, safe to call from several threads
+        uint32_t push(const void* data, VkDeviceSize size) {
+            VkDeviceSize alignedSize = (size + alignment - 1) & ~(alignment - 1);
+            VkDeviceSize offset = head.fetch_add(alignedSize);
+            if (offset + alignedSize > frameSize) {
+                throw std::runtime_error("uniform ring is full!");
+            }
+
+            memcpy(mapped + frameBase + offset, data, size);
+            bytesWritten += size;
+            return static_cast<uint32_t>(frameBase + offset);
+        }
+
+        VkDeviceSize footprint() const { return head; }
+
+        std::atomic<VkDeviceSize> bytesWritten{0};
+
+    private:
+        char* mapped = nullptr;
+        VkDeviceSize frameSize = 0;
+        VkDeviceSize alignment = 1;
+        VkDeviceSize frameBase = 0;
+        std::atomic<VkDeviceSize> head{0};
+};
+
+//contents of one descriptor binding, either a buffer or an image
+struct DescriptorWrite {
+    uint32_t binding;
+    VkDescriptorType type;
+    VkDescriptorBufferInfo bufferInfo;
+    VkDescriptorImageInfo imageInfo;
+};
+
+//hands out descriptor sets from a chain of pools, a new and larger pool is added whenever the current one runs out,
+//reset() recycles every set at once so per-frame allocators never free sets individually
+class DescriptorAllocator {
+    public:
+        //setSizes is what one set needs, pools are sized for setsPerPool of those sets
+        void create(VkDevice device, const std::vector<VkDescriptorPoolSize>& setSizes, uint32_t setsPerPool) {
+            this->device = device;
+            this->setSizes = setSizes;
+            this->setsPerPool = std::max(1u, setsPerPool);
+        }
+
+        void destroy() {
+            for (auto pool : usedPools) {
+                vkDestroyDescriptorPool(device, pool, nullptr);
+            }
+            for (auto pool : freePools) {
+                vkDestroyDescriptorPool(device, pool, nullptr);
+            }
+            usedPools.clear();
+            freePools.clear();
+            currentPool = VK_NULL_HANDLE;
+            cachedSets.clear();
+        }
+
+        //recycle every set handed out so far, the GPU must be done with all of them
+        void reset() {
+            for (auto pool : usedPools) {
+                vkResetDescriptorPool(device, pool, 0);
+                freePools.push_back(pool);
+            }
+            usedPools.clear();
+            currentPool = VK_NULL_HANDLE;
+            cachedSets.clear();
+        }
+
+        VkDescriptorSet allocate(VkDescriptorSetLayout layout) {
+            if (currentPool == VK_NULL_HANDLE) {
+                currentPool = nextPool();
+            }
+
+            VkDescriptorSetAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.descriptorPool = currentPool;
+            allocInfo.descriptorSetCount = 1;
+            allocInfo.pSetLayouts = &layout;
+
+            VkDescriptorSet set;
+            VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+            if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+                currentPool = nextPool();
+                allocInfo.descriptorPool = currentPool;
+                result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+            }
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate descriptor sets!");
+            }
+
+            allocations++;
+            return set;
+        }
+
+        //allocate and write a set, or return the set already written with identical contents since the last reset
+        VkDescriptorSet allocateCached(VkDescriptorSetLayout layout, const std::vector<DescriptorWrite>& writes) {
+            std::vector<uint64_t> key = {(uint64_t) layout};
+            for (auto& write : writes) {
+                key.insert(key.end(), {write.binding, (uint64_t) write.type, (uint64_t) write.bufferInfo.buffer, write.bufferInfo.offset, write.bufferInfo.range,
+                                       (uint64_t) write.imageInfo.sampler, (uint64_t) write.imageInfo.imageView, (uint64_t) write.imageInfo.imageLayout});
+            }
+
+            auto it = cachedSets.find(key);
+            if (it != cachedSets.end()) {
+                cacheHits++;
+                return it->second;
+            }
+
+            VkDescriptorSet set = allocate(layout);
+            write(set, writes);
+            cachedSets.emplace(std::move(key), set);
+            return set;
+        }
+
+        void write(VkDescriptorSet set, const std::vector<DescriptorWrite>& writes) {
+            std::vector<VkWriteDescriptorSet> descriptorWrites(writes.size());
+            for (size_t i = 0; i < writes.size(); i++) {
+                descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[i].dstSet = set;
+                descriptorWrites[i].dstBinding = writes[i].binding;
+                descriptorWrites[i].dstArrayElement = 0;
+                descriptorWrites[i].descriptorType = writes[i].type;
+                descriptorWrites[i].descriptorCount = 1;
+                descriptorWrites[i].pBufferInfo = &writes[i].bufferInfo;
+                descriptorWrites[i].pImageInfo = &writes[i].imageInfo;
+            }
+
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+
+        size_t poolCount() const { return usedPools.size() + freePools.size(); }
+
+        uint64_t allocations = 0;
+        uint64_t cacheHits = 0;
+
+    private:
+        VkDevice device = VK_NULL_HANDLE;
+        std::vector<VkDescriptorPoolSize> setSizes;
+        uint32_t setsPerPool = 1;
+        VkDescriptorPool currentPool = VK_NULL_HANDLE;
+        std::vector<VkDescriptorPool> usedPools;
+        std::vector<VkDescriptorPool> freePools;     //reset pools waiting to be reused
+        std::map<std::vector<uint64_t>, VkDescriptorSet> cachedSets;
+
+        //reuse a reset pool if there is one, otherwise create a pool twice as large as the last one
+        VkDescriptorPool nextPool() {
+            if (!freePools.empty()) {
+                usedPools.push_back(freePools.back());
+                freePools.pop_back();
+                return usedPools.back();
+            }
+
+            std::vector<VkDescriptorPoolSize> poolSizes = setSizes;
+            for (auto& poolSize : poolSizes) {
+                poolSize.descriptorCount *= setsPerPool;
+            }
+
+            VkDescriptorPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+            poolInfo.pPoolSizes = poolSizes.data();
+            poolInfo.maxSets = setsPerPool;
+
+            VkDescriptorPool pool;
+            if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create descriptor pool!");
+            }
+
+            setsPerPool = std::min(setsPerPool * 2, 4096u);
+            usedPools.push_back(pool);
+            return pool;
+        }
+};
+
+#ifdef SHADER_HOT_RELOAD
+//compiles GLSL to SPIR-V in process, results are cached on disk under a hash of the source so unchanged
+//shaders are never compiled twice, not even across runs
+class ShaderCompiler {
+    public:
+        explicit ShaderCompiler(const std::string& cacheDirectory) : cacheDirectory(cacheDirectory) {
+            std::error_code error;
+            std::filesystem::create_directories(cacheDirectory, error);
+            options.SetOptimizationLevel(shaderc_optimization_level_performance);
+        }
+
+        //throws std::runtime_error with the compiler log if the source does not compile
+        std::vector<uint32_t> compile(const std::string& path, shaderc_shader_kind kind) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file.is_open()) {
+                throw std::runtime_error("failed to open shader source " + path + "!");
+            }
+            std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+            //FNV-1a over the source and the stage, bump the salt when compile options change
+            uint64_t hash = 14695981039346656037ull ^ 0x5350563031ull;
+            for (char c : source + std::to_string(kind)) {
+                hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+            }
+
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(hash));
+            std::string cachePath = cacheDirectory + "/" + name;
+
+            std::ifstream cached(cachePath, std::ios::ate | std::ios::binary);
+            if (cached.is_open()) {
+                size_t size = (size_t) cached.tellg();
+                if (size > 0 && size % sizeof(uint32_t) == 0) {
+                    std::vector<uint32_t> code(size / sizeof(uint32_t));
+                    cached.seekg(0);
+                    cached.read(reinterpret_cast<char*>(code.data()), size);
+                    if (cached) {
+                        cacheHits++;
+                        return code;
+                    }
+                }
+            }
+
+            shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, kind, path.c_str(), options);
+            if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+                throw std::runtime_error(result.GetErrorMessage());
+            }
+            std::vector<uint32_t> code(result.cbegin(), result.cend());
+            compiles++;
+
+            std::string tempPath = cachePath + ".tmp";
+            {
+                std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+                out.write(reinterpret_cast<const char*>(code.data()), code.size() * sizeof(uint32_t));
+            }
+            std::error_code error;
+            std::filesystem::rename(tempPath, cachePath, error);
+
+            return code;
+        }
+
+        uint32_t cacheHits = 0;
+        uint32_t compiles = 0;
+
+    private:
+        std::string cacheDirectory;
+        shaderc::Compiler compiler;
+        shaderc::CompileOptions options;
+};
+
+//non-blocking inotify watch on the shader directory
+class ShaderWatcher {
+    public:
+        explicit ShaderWatcher(const std::string& directory) {
+            fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            //editors that save by renaming a temporary file produce IN_MOVED_TO instead of IN_CLOSE_WRITE
+            if (fd < 0 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+                throw std::runtime_error("failed to watch shader directory!");
+            }
+        }
+
+        ~ShaderWatcher() {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        ShaderWatcher(const ShaderWatcher&) = delete;
+        ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+        //true if a .vert or .frag file was written since the last call
+        bool poll() {
+            alignas(inotify_event) char buffer[4096];
+            bool changed = false;
+
+            ssize_t length;
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+                for (char* event = buffer; event < buffer + length; event += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(event)->len) {
+                    auto* info = reinterpret_cast<inotify_event*>(event);
+                    std::string name = info->len > 0 ? info->name : "";
+                    std::string extension = std::filesystem::path(name).extension().string();
+                    if (extension == ".vert" || extension == ".frag") {
+                        changed = true;
+                    }
+                }
+            }
+
+            return changed;
+        }
+
+    private:
+        int fd = -1;
+};
+#endif
+
+//prefix written in front of the driver's pipeline cache data, the driver header does not include the driver version
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t dataSize;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+const uint32_t PIPELINE_CACHE_MAGIC = 0x43504b56;   //"VKPC"
+
+//range of the index buffer drawn by a single vkCmdDrawIndexed
+struct DrawCommand {
+    uint32_t indexCount;
+    uint32_t firstIndex;
+};
+
+//data inside uniform buffers
+struct UniformBufferObject {
+    alignas(16) glm::mat4 view;
+    alignas(16) glm::mat4 proj;
+    alignas(16) glm::mat4 viewProj;     //proj * view, so the vertex shader does one matrix product less per vertex
+    alignas(4) uint32_t featureFlags;   //ShaderFeatureBits, only read by pipelines built with SHADER_FEATURE_DYNAMIC
+};
+
+//per draw data pushed with vkCmdPushConstants, must match the push_constant block in shader.vert
+struct PushConstants {
+    glm::mat4 model;
+};
+
+//per draw data written to the uniform ring, must match the ObjectData block in shader.vert
+struct ObjectData {
+    alignas(16) glm::mat4 model;
+};
+
+//binding of ObjectData, bound with a dynamic offset per draw
+const uint32_t OBJECT_DATA_BINDING = 2;
+
+//camera orbiting a target, its matrices are cached and only rebuilt when the inputs they depend on change
+class Camera {
+    public:
+        Camera(glm::vec3 eye, glm::vec3 target) : target(target) {
+            glm::vec3 offset = eye - target;
+            distance = glm::length(offset);
+            yaw = std::atan2(offset.y, offset.x);
+            pitch = std::asin(offset.z / distance);
+        }
+
+        //rotate around the target, pitch stays short of the poles where the up vector would flip
+        void orbit(float yawDelta, float pitchDelta) {
+            const float pitchLimit = glm::radians(89.0f);
+            yaw += yawDelta;
+            pitch = std::clamp(pitch + pitchDelta, -pitchLimit, pitchLimit);
+            viewDirty = true;
+        }
+
+        void setAspect(float aspectRatio) {
+            if (aspectRatio != aspect) {
+                aspect = aspectRatio;
+                projDirty = true;
+            }
+        }
+
+        //rebuild the matrices whose inputs changed since the last call
+        void update() {
+            if (viewDirty) {
+                glm::vec3 eye = target + distance * glm::vec3(std::cos(pitch) * std::cos(yaw), std::cos(pitch) * std::sin(yaw), std::sin(pitch));
+                viewMatrix = glm::lookAt(eye, target, glm::vec3(0.0f, 0.0f, 1.0f));
+                viewVersion++;
+            }
+            if (projDirty) {
+                projMatrix = glm::perspective(fovy, aspect, nearPlane, farPlane);
+                projMatrix[1][1] *= -1;
+                projVersion++;
+            }
+            if (viewDirty || projDirty) {
+                viewProjMatrix = projMatrix * viewMatrix;
+            }
+            viewDirty = false;
+            projDirty = false;
+        }
+
+        const glm::mat4& view() const { return viewMatrix; }
+        const glm::mat4& proj() const { return projMatrix; }
+        const glm::mat4& viewProj() const { return viewProjMatrix; }
+
+        //incremented whenever the matrix is rebuilt, lets every copy of the matrices tell whether it is stale
+        uint64_t viewVersion = 0;
+        uint64_t projVersion = 0;
+
+    private:
+        glm::vec3 target;
+        float distance;
+        float yaw;
+        float pitch;
+        float fovy = glm::radians(45.0f);
+        float aspect = 1.0f;
+        float nearPlane = 0.1f;
+        float farPlane = 10.0f;
+
+        bool viewDirty = true;
+        bool projDirty = true;
+        glm::mat4 viewMatrix{1.0f};
+        glm::mat4 projMatrix{1.0f};
+        glm::mat4 viewProjMatrix{1.0f};
+};
+
+//what a frame in flight's uniform buffer currently holds, so only stale ranges are written
+struct UniformBufferState {
+    uint64_t viewVersion = 0;           //0 is never a camera version, a fresh buffer is written in full
+    uint64_t projVersion = 0;
+    uint32_t featureFlags = std::numeric_limits<uint32_t>::max();
+};
+
+class HelloTriangleApplication {
+    public:
+        explicit HelloTriangleApplication(const AppSettings& settings) : settings(settings) {}
+
+        //Called from main, starts everything
+        void run(){
+            CPU_PROFILE_THREAD("main");
+            runStart = std::chrono::high_resolution_clock::now();
+            if (settings.benchmarkJobs) {
+                benchmarkJobSystem(settings.jobThreads);
+                return;
+            }
+
+            jobSystem = std::make_unique<JobSystem>(settings.jobThreads);
+            if (!settings.headless) {
+                initWindow();
+            }
+            initVulkan();
+            if (settings.headless || settings.singleThread) {
+                mainLoop();
+            } else {
+                runRenderThread();
+            }
+            cleanup();
+        }
+
+    private:
+        AppSettings settings;
+
+        GLFWwindow* window = nullptr;
+        
+        VkInstance instance;
+        VkDebugUtilsMessengerEXT debugMessenger;
+        VkSurfaceKHR surface = VK_NULL_HANDLE;     //stays null in headless runs
+        
+        VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+        VkDevice device;
+
+        VkQueue graphicsQueue;
+        VkQueue presentQueue;
+
+        VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+        std::vector<VkImage> swapChainImages;
+        VkFormat swapChainImageFormat;
+        VkExtent2D swapChainExtent;
+        VkPresentModeKHR swapChainPresentMode = VK_PRESENT_MODE_MAX_ENUM_KHR;
+        bool presentModeChanged = false;            //M switched the policy, the swap chain is recreated after the next present
+        std::map<VkPresentModeKHR, TimingStats> presentModeIntervals;   //milliseconds between presents in each mode used
+        std::map<VkPresentModeKHR, TimingStats> presentModeLatencies;   //latencyMetric() in each mode used
+        std::vector<VkImageView> swapChainImageViews;
+        std::vector<VkFramebuffer> swapChainFramebuffers;
+        std::vector<VkDeviceMemory> offscreenImageMemory;   //backs swapChainImages in headless runs
+        uint32_t lastImageIndex = 0;                        //image the most recent frame rendered into
+
+        VkRenderPass renderPass;
+        DescriptorLayoutCache layoutCache;
+        ShaderInterface shaderInterface;            //reflected from the shaders, the layouts below are generated from it
+        std::vector<VkDescriptorSetLayout> descriptorSetLayouts;
+        VkDescriptorSetLayout descriptorSetLayout;  //set 0, the only set the descriptor sets below are allocated for
+        VkPipelineLayout pipelineLayout;
+        VkPipeline graphicsPipeline;                //default pipeline, always ready and used as fallback while variants compile
+        PipelineRegistry pipelineRegistry;
+        std::vector<PipelineKey> pipelineVariants;  //cycled with the P key
+        size_t activePipelineVariant = 0;
+        PipelineKey defaultPipelineKey;
+        VkPipeline boundPipeline = VK_NULL_HANDLE;  //pipeline the command buffers of the current frame are recorded with
+        bool boundObjectDataInRing = false;         //boundPipeline reads the model matrix from the object ring
+        uint32_t shaderFeatures = SHADER_FEATURE_TEXTURE;  //quality tier, cycled with the T key
+        bool dynamicShaderFeatures = false;         //U toggles branching on ubo.featureFlags instead of specialised pipelines
+        std::shared_ptr<const ShaderBinaries> shaderBinaries;  //shaders new pipelines are built from, replaced on hot reload
+        std::mutex shaderBinariesMutex;
+#ifdef SHADER_HOT_RELOAD
+        std::unique_ptr<ShaderCompiler> shaderCompiler;
+        std::unique_ptr<ShaderWatcher> shaderWatcher;
+        std::unique_ptr<ThreadPool> shaderReloadThread;
+#endif
+        VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+        bool pipelineCacheWarm = false;             //pipelineCache was seeded from a compatible cache file
+
+        VkCommandPool commandPool;
+
+        VkImage depthImage;
+        VkDeviceMemory depthImageMemory;
+        VkImageView depthImageView;
+
+        stbi_uc* texturePixels = nullptr;           //decoded by decodeTexture, freed once createTextureImage has staged it
+        int textureWidth = 0;
+        int textureHeight = 0;
+        VkImage textureImage;
+        VkDeviceMemory textureImageMemory;
+
+        VkCommandBuffer uploadCommandBuffer = VK_NULL_HANDLE;   //set between beginUploadBatch and submitUploadBatch
+        std::vector<std::pair<VkBuffer, VkDeviceMemory>> uploadStagingBuffers;  //destroyed once the batch has finished
+
+        VkImageView textureImageView;
+        VkSampler textureSampler;
+
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        std::vector<DrawCommand> drawList;
+        glm::mat4 modelMatrix = glm::mat4(1.0f);    //per draw data, pushed or written to the object ring with every draw
+        bool animating = true;                      //the model spins, A toggles it, --on-demand starts still unless --animate
+        float animationTime = 0.0f;                 //seconds the model has spun for, frozen while not animating
+        std::chrono::high_resolution_clock::time_point lastAnimationUpdate = std::chrono::high_resolution_clock::now();
+        bool redrawRequested = true;                //something on screen changed, --on-demand draws one more frame
+
+        VkBuffer objectRingBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory objectRingMemory = VK_NULL_HANDLE;
+        size_t objectRingCapacity = 0;              //ObjectData allocations each frame in flight has room for
+        UniformRing objectRing;
+
+        VkBuffer vertexBuffer;
+        VkDeviceMemory vertexBufferMemory;
+        VkBuffer indexBuffer;
+        VkDeviceMemory indexBufferMemory;
+
+        std::vector<VkBuffer> uniformBuffers;
+        std::vector<VkDeviceMemory> uniformBuffersMemory;
+        std::vector<void*> uniformBuffersMapped;
+        std::vector<UniformBufferState> uniformBufferStates;
+
+        Camera camera{glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f)};
+        TimingStats uniformUpdateTimings;           //microseconds spent in updateUniformBuffer
+        TimingStats uniformBytesWritten;            //bytes of uniform data written per frame
+
+        DescriptorAllocator descriptorAllocator;    //long lived sets, recorded into cached command buffers
+        std::vector<DescriptorAllocator> frameDescriptorAllocators;    //[frame], sets that only live for one frame, reset after its fence wait
+        std::vector<VkDescriptorSet> descriptorSets;                    //[frame], only with --cache-commands
+        VkDescriptorSet frameDescriptorSet = VK_NULL_HANDLE;           //set 0 bound by the frame being recorded
+
+        std::vector<FrameCommandPool> frameCommandPools;                        //[frame], primary command buffers
+        std::unique_ptr<JobSystem> jobSystem;      //shared by init, command recording and anything else that runs in parallel
+        std::vector<std::vector<FrameCommandPool>> recordCommandPools;          //[frame][secondary], one pool per recording job
+        VkCommandPool cachedCommandPool = VK_NULL_HANDLE;
+        struct CachedCommandBuffer {
+            VkCommandBuffer commandBuffer = VK_NULL_HANDLE;     //until first recorded
+            glm::mat4 model;                                    //model matrix pushed when it was recorded
+        };
+        std::vector<std::vector<CachedCommandBuffer>> cachedCommandBuffers;     //[frame][image]
+        uint64_t cachedModelRerecords = 0;          //cached buffers recorded again because the model moved
+        TimingStats recordTimings;
+        TimingStats frameTimings;
+
+        GpuProfiler gpuProfiler;
+        TimingStats gpuFrameTimings;                //the "frame" GPU scope
+
+        PipelineStatisticsQueries pipelineStatistics;
+        bool pipelineStatisticsActive = true;       //record the queries, only turned off to measure what they cost
+        std::array<TimingStats, PIPELINE_COUNTER_NAMES.size()> pipelineCounterStats;
+        std::string pipelineStatisticsOverhead;     //JSON object written by benchmarkPipelineStatistics, empty if not measured
+
+        std::vector<VkSemaphore> imageAvailableSemaphores;
+        std::vector<VkSemaphore> renderFinishedSemaphores;
+        std::vector<VkFence> inFlightFences;
+        uint32_t currentFrame = 0;
+
+        uint64_t frameNumber = 0;                   //number of frames submitted to the GPU so far
+        std::chrono::high_resolution_clock::time_point runStart;  //start of run, the first submit reports the time to first frame from it
+        double initTime = 0.0;                      //milliseconds spent in initVulkan
+        std::vector<uint64_t> frameNumberInFlight;  //frameNumber last submitted from each frame slot
+        std::chrono::steady_clock::time_point lastInputTime;    //when pollEvents last applied window input, the frame drawn next reflects it
+
+        //latency per frame, input sample to present where VK_GOOGLE_display_timing reports when presents reached the display,
+        //otherwise submit to GPU completion from polling the frame fences
+        struct LatencySample {
+            uint32_t presentID;                     //low bits of frameNumber, what display timing reports presents by
+            std::chrono::steady_clock::time_point start;    //input sample with display timing, submit without
+            VkPresentModeKHR presentMode;
+        };
+        PFN_vkGetPastPresentationTimingGOOGLE getPastPresentationTiming = nullptr;     //set when the device has VK_GOOGLE_display_timing
+        std::deque<LatencySample> pendingPresents;  //presents display timing has not reported yet
+        std::vector<std::optional<LatencySample>> frameSubmitLatency;   //frame in each slot whose fence has not been seen signaled yet
+        TimingStats latencyTimings;
+
+        bool measuringBenchmark = false;            //frames add their timings to the series below, off during warm-up
+        SampleSeries benchmarkCpuFrame;             //acquire to present, in milliseconds
+        SampleSeries benchmarkCpuFramePaused;       //the same for frames drawn with CPU trace recording paused, CPU_PROFILING builds only
+        SampleSeries benchmarkGpuFrame;             //"frame" GPU scope, in milliseconds
+        SampleSeries benchmarkFenceWait;            //time blocked on the frame slot's fence, in milliseconds
+        uint64_t completedFrameNumber = 0;          //every frame up to and including this one has finished on the GPU
+        DeletionQueue deletionQueue;
+
+        bool framebufferResized = false;
+        int framebufferWidth = 0;                   //latest size from the resize events, owned by the rendering thread
+        int framebufferHeight = 0;
+
+        SpscQueue<WindowEvent, 4096> windowEvents;  //GLFW callbacks to the rendering thread
+        uint32_t droppedWindowEvents = 0;           //events lost to a full queue, only the GLFW thread touches it
+        std::atomic<bool> windowClosing{false};     //set by the GLFW thread once the window has been asked to close
+        std::atomic<bool> renderThreadDone{false};
+        std::mutex windowEventMutex;                //only guards the sleep of an idle render thread
+        std::condition_variable windowEventSignal;
+        std::chrono::high_resolution_clock::time_point interactionEnd;     //frames presented before this were during a drag or resize
+        std::chrono::high_resolution_clock::time_point lastPresentTime;    //zero until the first present and after idling
+        SampleSeries framePacing;                   //milliseconds between presents while the window is left alone
+        SampleSeries interactionPacing;             //and while it is being dragged or resized
+
+        //initiates GLFW and creates a window
+        void initWindow(){
+            glfwInit();
+            
+            glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);                   //tells GLFW not to make OpenGL context (default)
+
+            window = glfwCreateWindow(settings.width,settings.height,"Vulkan",nullptr,nullptr);    //creates window
+            glfwSetWindowUserPointer(window, this);
+            glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+            glfwSetWindowPosCallback(window, windowPosCallback);
+            glfwSetWindowRefreshCallback(window, windowRefreshCallback);
+            glfwSetKeyCallback(window, keyCallback);
+
+            //later sizes arrive as resize events, so the rendering thread never calls into GLFW
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        }
+
+        //queue an event for the rendering thread, called on the thread that polls GLFW
+        void pushWindowEvent(const WindowEvent& event) {
+            if (!windowEvents.push(event)) {
+                droppedWindowEvents++;
+            }
+            wakeRenderThread();
+        }
+
+        //wake a render thread sleeping in waitForWindowEvents, taking the mutex so the wakeup cannot fall between its check and its wait
+        void wakeRenderThread() {
+            {
+                std::lock_guard<std::mutex> lock(windowEventMutex);
+            }
+            windowEventSignal.notify_one();
+        }
+
+        //key presses are queued and applied by handleKey on the rendering thread
+        static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+            auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+            app->pushWindowEvent({WindowEvent::Type::Key, key, action, 0, 0});
+        }
+
+        //define callback function for when GLFWwindow is resized, the new size travels with the event so the rendering
+        //thread sees the size and the resized flag together
+        static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
+            auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+            app->pushWindowEvent({WindowEvent::Type::Resize, 0, 0, width, height});
+        }
+
+        //window moves only mark the frames presented during a drag for the pacing report
+        static void windowPosCallback(GLFWwindow* window, int x, int y) {
+            auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+            app->pushWindowEvent({WindowEvent::Type::Move, 0, 0, 0, 0});
+        }
+
+        //the window contents were damaged (uncovered, restored, expose), on-demand rendering has to draw them again
+        static void windowRefreshCallback(GLFWwindow* window) {
+            auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+            app->pushWindowEvent({WindowEvent::Type::Refresh, 0, 0, 0, 0});
+        }
+
+        //P cycles through the graphics pipeline variants, the arrow keys orbit the camera, A starts and stops the animation,
+        //M switches to the next present mode policy
+        void handleKey(int key, int action) {
+            redrawRequested = true;
+            if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+                auto policy = std::find_if(PRESENT_POLICIES.begin(), PRESENT_POLICIES.end(), [&](const auto& entry) { return entry.first == settings.presentPolicy; });
+                policy = (policy == PRESENT_POLICIES.end() || policy + 1 == PRESENT_POLICIES.end()) ? PRESENT_POLICIES.begin() : policy + 1;
+                settings.presentPolicy = policy->first;
+                presentModeChanged = true;
+                std::cout << "present policy " << settings.presentPolicy << std::endl;
+            }
+            if (key == GLFW_KEY_A && action == GLFW_PRESS) {
+                animating = !animating;
+                lastAnimationUpdate = std::chrono::high_resolution_clock::now();
+                std::cout << (animating ? "animating" : "animation stopped") << std::endl;
+            }
+            if (action == GLFW_PRESS || action == GLFW_REPEAT) {
+                const float step = glm::radians(5.0f);
+                if (key == GLFW_KEY_LEFT) camera.orbit(-step, 0.0f);
+                if (key == GLFW_KEY_RIGHT) camera.orbit(step, 0.0f);
+                if (key == GLFW_KEY_UP) camera.orbit(0.0f, step);
+                if (key == GLFW_KEY_DOWN) camera.orbit(0.0f, -step);
+            }
+            if (key == GLFW_KEY_P && action == GLFW_PRESS && !pipelineVariants.empty()) {
+                activePipelineVariant = (activePipelineVariant + 1) % pipelineVariants.size();
+                std::cout << "pipeline variant " << activePipelineVariant << std::endl;
+            }
+            if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+                const uint32_t tiers[] = {SHADER_FEATURE_TEXTURE, SHADER_FEATURE_TEXTURE | SHADER_FEATURE_VERTEX_COLOR, SHADER_FEATURE_VERTEX_COLOR};
+                size_t tier = std::find(std::begin(tiers), std::end(tiers), shaderFeatures) - std::begin(tiers);
+                shaderFeatures = tiers[(tier + 1) % std::size(tiers)];
+                std::cout << "shader features " << shaderFeatures << std::endl;
+            }
+            if (key == GLFW_KEY_U && action == GLFW_PRESS) {
+                dynamicShaderFeatures = !dynamicShaderFeatures;
+                std::cout << (dynamicShaderFeatures ? "uniform branching" : "specialised") << " shader features" << std::endl;
+            }
+        }
+
+        //initiates all Vulkan objects as a task graph, only the steps that need the device wait for createLogicalDevice, the CPU
+        //only work (shaders, texture decode, OBJ parsing) overlaps instance and device creation, and the uploads share one submit
+        void initVulkan(){
+            CPU_PROFILE_FUNCTION();
+
+            TaskGraph graph;
+            auto instance = graph.add("createInstance", [this]() { createInstance(); });
+            //vkCreateDebugUtilsMessengerEXT needs the instance externally synchronized, so the instance level steps follow it
+            auto debugMessenger = graph.add("setupDebugMessenger", [this]() { setupDebugMessenger(); }, {instance});
+            auto surface = graph.add("createSurface", [this]() {
+                if (!settings.headless) {
+                    createSurface();
+                }
+            }, {debugMessenger});
+            auto physicalDevice = graph.add("pickPhysicalDevice", [this]() { pickPhysicalDevice(); }, {surface});
+            auto device = graph.add("createLogicalDevice", [this]() { createLogicalDevice(); }, {physicalDevice});
+
+            auto shaders = graph.add("loadShaders", [this]() { loadShaders(); });
+            auto texture = graph.add("decodeTexture", [this]() { decodeTexture(); });
+            auto model = graph.add("loadModel", [this]() { loadModel(); });
+            auto drawList = graph.add("buildDrawList", [this]() { buildDrawList(); }, {model});
+
+            auto pipelineCache = graph.add("createPipelineCache", [this]() { createPipelineCache(); }, {device});
+            auto swapChain = graph.add("createSwapChain", [this]() { createSwapChain(); }, {device});
+            auto imageViews = graph.add("createImageViews", [this]() { createImageViews(); }, {swapChain});
+            auto renderPass = graph.add("createRenderPass", [this]() { createRenderPass(); }, {swapChain});
+            auto setLayout = graph.add("createDescriptorSetLayout", [this]() { createDescriptorSetLayout(); }, {device, shaders});
+            graph.add("createGraphicsPipeline", [this]() { createGraphicsPipeline(); }, {renderPass, setLayout, pipelineCache});
+            auto depth = graph.add("createDepthResources", [this]() { createDepthResources(); }, {swapChain});
+            graph.add("createFramebuffers", [this]() { createFramebuffers(); }, {imageViews, renderPass, depth});
+
+            //uploads record into one command buffer, so they follow each other
+            auto commandPool = graph.add("createCommandPool", [this]() { createCommandPool(); }, {device});
+            auto uploads = graph.add("beginUploadBatch", [this]() { beginUploadBatch(); }, {commandPool});
+            auto textureImage = graph.add("createTextureImage", [this]() { createTextureImage(); }, {uploads, texture});
+            auto textureView = graph.add("createTextureImageView", [this]() { createTextureImageView(); }, {textureImage});
+            auto sampler = graph.add("createTextureSampler", [this]() { createTextureSampler(); }, {device});
+            auto vertexBuffer = graph.add("createVertexBuffer", [this]() { createVertexBuffer(); }, {textureImage, model});
+            auto indexBuffer = graph.add("createIndexBuffer", [this]() { createIndexBuffer(); }, {vertexBuffer});
+            graph.add("submitUploadBatch", [this]() { submitUploadBatch(); }, {indexBuffer});
+
+            auto uniformBuffers = graph.add("createUniformBuffers", [this]() { createUniformBuffers(); }, {device, drawList});
+            auto allocators = graph.add("createDescriptorAllocators", [this]() { createDescriptorAllocators(); }, {setLayout});
+            graph.add("createDescriptorSets", [this]() { createDescriptorSets(); }, {allocators, uniformBuffers, textureView, sampler});
+            graph.add("createFrameCommandPools", [this]() { createFrameCommandPools(); }, {device});
+            graph.add("createSyncObjects", [this]() { createSyncObjects(); }, {device});
+            graph.add("createGpuProfiler", [this]() { createGpuProfiler(); }, {device});
+            graph.add("createPipelineStatistics", [this]() { createPipelineStatistics(); }, {device});
+
+            auto initStart = std::chrono::high_resolution_clock::now();
+            if (settings.serialInit) {
+                graph.runSerial();
+            } else {
+                graph.run(*jobSystem);
+            }
+            initTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - initStart).count();
+
+            std::cout << "initVulkan took " << initTime << " ms (" << (settings.serialInit ? "serial" : "task graph") << "), slowest steps:" << std::endl;
+            graph.printSlowest(5);
+        }
+
+        //loop while window remains open
+        void mainLoop(){
+            if (settings.sweepFramesInFlight) {
+                sweepFramesInFlight();
+            }
+            if (settings.benchmarkSpecialization) {
+                benchmarkSpecialization();
+            }
+            if (settings.benchmarkDescriptors) {
+                benchmarkDescriptors();
+            }
+            if (settings.benchmarkDrawScaling) {
+                benchmarkDrawScaling();
+            }
+            if (settings.benchmarkPipelineStatistics) {
+                benchmarkPipelineStatistics();
+            }
+            if (settings.benchmark) {
+                runBenchmark();
+            }
+
+            //headless runs have no events to wait for
+            bool onDemand = settings.onDemand && !settings.headless;
+            if (onDemand) {
+                animating = settings.animate;
+            }
+
+            auto loopStart = std::chrono::high_resolution_clock::now();
+            std::clock_t loopCpuStart = std::clock();
+            double gpuBusyStart = gpuFrameTimings.total;
+            uint32_t frame = 0;
+            uint32_t idleWakeups = 0;
+            double idleTime = 0.0;
+
+            while (windowOpen() && !runsBenchmark() && (settings.frames == 0 || frame < settings.frames)) {
+                pollEvents();
+
+                //nothing moved, sleep in the event wait instead of drawing the same image again
+                if (onDemand && !animating && !redrawRequested) {
+                    collectLatency(true);       //the fences are not polled while idle, take the last frames' completion now
+                    auto idleStart = std::chrono::high_resolution_clock::now();
+                    waitForWindowEvents(IDLE_WAIT_TIMEOUT);
+                    applyShaderReload();
+                    idleTime += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - idleStart).count();
+                    idleWakeups++;
+                    lastPresentTime = {};       //the idle gap is not a pacing hitch
+                    continue;
+                }
+
+                redrawRequested = false;
+                drawFrame();
+                frame++;
+            }
+
+            vkDeviceWaitIdle(device);
+
+            //process CPU time covers every thread, GPU time is only known when the queue supports timestamps
+            double loopTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - loopStart).count();
+            if (!runsBenchmark() && loopTime > 0.0) {
+                double cpuTime = static_cast<double>(std::clock() - loopCpuStart) / CLOCKS_PER_SEC;
+                std::cout << (onDemand ? "on demand" : "continuous") << " rendering: " << frame << " frames in " << loopTime << " s";
+                if (onDemand) {
+                    std::cout << ", idle " << 100.0 * idleTime / loopTime << "% of the time (" << idleWakeups << " wakeups)";
+                }
+                std::cout << ", CPU " << 100.0 * cpuTime / loopTime << "% of one core";
+                if (gpuProfiler.enabled()) {
+                    std::cout << ", GPU busy " << 100.0 * (gpuFrameTimings.total - gpuBusyStart) / 1000.0 / loopTime << "%";
+                }
+                std::cout << std::endl;
+            }
+
+            if (!settings.outputPath.empty()) {
+                saveOffscreenImage(settings.outputPath);
+            }
+        }
+
+        //false once the window has been closed, headless runs end after settings.frames instead
+        bool windowOpen() {
+            return settings.headless || !windowClosing.load(std::memory_order_relaxed);
+        }
+
+        //apply the queued window events, GLFW is polled here only when it runs on the same thread
+        void pollEvents() {
+            if (settings.headless) {
+                return;
+            }
+            if (settings.singleThread) {
+                glfwPollEvents();
+                windowClosing = glfwWindowShouldClose(window) != 0;
+            }
+
+            while (auto event = windowEvents.pop()) {
+                switch (event->type) {
+                    case WindowEvent::Type::Key:
+                        handleKey(event->key, event->action);
+                        break;
+                    case WindowEvent::Type::Resize:
+                        framebufferWidth = event->width;
+                        framebufferHeight = event->height;
+                        framebufferResized = true;
+                        redrawRequested = true;
+                        interactionEnd = std::chrono::high_resolution_clock::now() + std::chrono::milliseconds(250);
+                        break;
+                    case WindowEvent::Type::Move:
+                        interactionEnd = std::chrono::high_resolution_clock::now() + std::chrono::milliseconds(250);
+                        break;
+                    case WindowEvent::Type::Refresh:
+                        redrawRequested = true;
+                        break;
+                }
+            }
+            lastInputTime = std::chrono::steady_clock::now();
+        }
+
+        //block until there are new window events or the timeout passes, then apply them
+        void waitForWindowEvents(double timeoutSeconds) {
+            if (settings.singleThread) {
+                glfwWaitEventsTimeout(timeoutSeconds);
+            } else {
+                std::unique_lock<std::mutex> lock(windowEventMutex);
+                windowEventSignal.wait_for(lock, std::chrono::duration<double>(timeoutSeconds), [this]() { return !windowEvents.empty() || !windowOpen(); });
+            }
+            pollEvents();
+        }
+
+        //GLFW stays on the main thread, which only waits for events and hands them over, so a slow event (a window drag
+        //blocking in the compositor) does not stall rendering and a slow frame does not delay input
+        void runRenderThread() {
+            //command recording spawns its jobs from the render thread, so it takes over the job system's owner deque
+            std::exception_ptr renderError;
+            jobSystem->releaseOwnership();
+            std::thread renderThread([this, &renderError]() {
+                CPU_PROFILE_THREAD("render");
+                jobSystem->takeOwnership();
+                try {
+                    mainLoop();
+                } catch (...) {
+                    renderError = std::current_exception();
+                }
+                jobSystem->releaseOwnership();
+                renderThreadDone = true;
+                glfwPostEmptyEvent();
+            });
+
+            while (!renderThreadDone) {
+                glfwWaitEvents();
+                if (glfwWindowShouldClose(window) && !windowClosing) {
+                    windowClosing = true;
+                    wakeRenderThread();
+                }
+            }
+            renderThread.join();
+            jobSystem->takeOwnership();
+
+            if (droppedWindowEvents > 0) {
+                std::cerr << droppedWindowEvents << " window events were dropped because the render thread fell behind" << std::endl;
+            }
+            if (renderError) {
+                std::rethrow_exception(renderError);
+            }
+        }
+
+        //benchmark modes exit once they have reported
+        bool runsBenchmark() const {
+            return settings.sweepFramesInFlight || settings.benchmarkSpecialization || settings.benchmarkDescriptors || settings.benchmarkDrawScaling || settings.benchmark ||
+                   settings.benchmarkPipelineStatistics;
+        }
+
+        //record, CPU frame and GPU frame time with and without the statistics queries
+        void benchmarkPipelineStatistics() {
+            const uint32_t warmupFrames = 60;
+            double record[2], cpuFrame[2], gpuFrame[2];
+
+            waitForPipeline();
+            for (int active = 0; active < 2 && windowOpen(); active++) {
+                pipelineStatisticsActive = active != 0;
+                invalidateCommandCache();
+
+                for (uint32_t i = 0; i < warmupFrames && windowOpen(); i++) {
+                    pollEvents();
+                    drawFrame();
+                }
+
+                recordTimings = TimingStats{};
+                frameTimings = TimingStats{};
+                gpuFrameTimings = TimingStats{};
+                for (uint32_t i = 0; i < settings.sweepFrames && windowOpen(); i++) {
+                    pollEvents();
+                    drawFrame();
+                }
+                record[active] = recordTimings.average();
+                cpuFrame[active] = frameTimings.average();
+                gpuFrame[active] = gpuFrameTimings.average();
+            }
+
+            std::cout << "pipeline statistics queries: record " << record[0] << " -> " << record[1] << " ms, cpu frame " << cpuFrame[0] << " -> " << cpuFrame[1]
+                      << " ms, gpu frame " << gpuFrame[0] << " -> " << gpuFrame[1] << " ms per frame (without -> with)" << std::endl;
+
+            std::ostringstream overhead;
+            overhead << "{\"frames\": " << settings.sweepFrames << ", \"record_ms\": [" << record[0] << ", " << record[1] << "], \"cpu_frame_ms\": ["
+                     << cpuFrame[0] << ", " << cpuFrame[1] << "], \"gpu_frame_ms\": [" << gpuFrame[0] << ", " << gpuFrame[1] << "]}";
+            pipelineStatisticsOverhead = overhead.str();
+        }
+
+        //draw settings.warmupFrames unmeasured frames, then settings.frames measured ones, and write the reports
+        void runBenchmark() {
+            waitForPipeline();
+            for (uint32_t i = 0; i < settings.warmupFrames && windowOpen(); i++) {
+                pollEvents();
+                drawFrame();
+            }
+
+            measuringBenchmark = true;
+            for (uint32_t i = 0; i < settings.frames && windowOpen(); i++) {
+#ifdef CPU_PROFILING
+                //alternate blocks of frames recording and paused, so drift over the run affects both equally, paused
+                //frames are kept out of the reported CPU frame time
+                const uint32_t profilerBlock = 30;
+                CpuProfiler::setPaused((i / profilerBlock) % 2 == 1);
+                size_t sampled = benchmarkCpuFrame.values.size();
+#endif
+                pollEvents();
+                drawFrame();
+#ifdef CPU_PROFILING
+                if (CpuProfiler::isPaused() && benchmarkCpuFrame.values.size() > sampled) {
+                    benchmarkCpuFramePaused.add(benchmarkCpuFrame.values.back());
+                    benchmarkCpuFrame.values.pop_back();
+                }
+#endif
+            }
+#ifdef CPU_PROFILING
+            CpuProfiler::setPaused(false);
+#endif
+
+            //the last frames' GPU timings are only read back once their slots come round again
+            vkDeviceWaitIdle(device);
+            for (uint32_t i = 0; i < settings.framesInFlight; i++) {
+                readGpuProfile();
+                currentFrame = (currentFrame + 1) % settings.framesInFlight;
+            }
+            measuringBenchmark = false;
+
+            writeBenchmarkReports();
+        }
+
+        //summaries of the benchmark series as <benchmarkOutput>.csv (one row per metric) and <benchmarkOutput>.json (run settings and metrics)
+        void writeBenchmarkReports() {
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+            const std::pair<const char*, const SampleSeries*> series[] = {
+                {"cpu_frame_ms", &benchmarkCpuFrame},
+                {"gpu_frame_ms", &benchmarkGpuFrame},
+                {"fence_wait_ms", &benchmarkFenceWait}
+            };
+
+            std::ofstream csv(settings.benchmarkOutput + ".csv");
+            csv << "metric,samples,mean,p50,p95,p99,max" << std::endl;
+            for (const auto& [name, samples] : series) {
+                csv << name << "," << samples->values.size() << "," << samples->mean() << "," << samples->percentile(50) << ","
+                    << samples->percentile(95) << "," << samples->percentile(99) << "," << samples->percentile(100) << std::endl;
+            }
+
+            std::ofstream json(settings.benchmarkOutput + ".json");
+            json << "{" << std::endl;
+            json << "  \"device\": \"" << properties.deviceName << "\"," << std::endl;
+            json << "  \"scene\": \"" << settings.scene << "\"," << std::endl;
+            json << "  \"draws\": " << drawList.size() << "," << std::endl;
+            json << "  \"resolution\": [" << swapChainExtent.width << ", " << swapChainExtent.height << "]," << std::endl;
+            json << "  \"present_mode\": \"" << (settings.headless ? "headless" : presentModeName(swapChainPresentMode)) << "\"," << std::endl;
+            json << "  \"frames_in_flight\": " << settings.framesInFlight << "," << std::endl;
+            json << "  \"warmup_frames\": " << settings.warmupFrames << "," << std::endl;
+            json << "  \"frames\": " << benchmarkCpuFrame.values.size() << "," << std::endl;
+            //diff cpu_frame_ms against a build without CPU_PROFILING, or read the paused frames of this run
+            if (benchmarkCpuFramePaused.values.empty()) {
+                json << "  \"cpu_profiling\": false," << std::endl;
+            } else {
+                json << "  \"cpu_profiling\": {\"paused_frames\": " << benchmarkCpuFramePaused.values.size() << ", \"paused_cpu_frame_ms_mean\": "
+                     << benchmarkCpuFramePaused.mean() << ", \"paused_cpu_frame_ms_p50\": " << benchmarkCpuFramePaused.percentile(50) << "}," << std::endl;
+            }
+            json << "  \"metrics\": {" << std::endl;
+            for (size_t i = 0; i < std::size(series); i++) {
+                const SampleSeries& samples = *series[i].second;
+                json << "    \"" << series[i].first << "\": {\"samples\": " << samples.values.size() << ", \"mean\": " << samples.mean()
+                     << ", \"p50\": " << samples.percentile(50) << ", \"p95\": " << samples.percentile(95) << ", \"p99\": " << samples.percentile(99)
+                     << ", \"max\": " << samples.percentile(100) << "}" << (i + 1 < std::size(series) ? "," : "") << std::endl;
+            }
+            json << "  }" << std::endl;
+            json << "}" << std::endl;
+
+            if (!csv || !json) {
+                throw std::runtime_error("failed to write benchmark reports!");
+            }
+
+            std::cout << "benchmark (" << settings.scene << ", " << benchmarkCpuFrame.values.size() << " frames): cpu frame p50 " << benchmarkCpuFrame.percentile(50)
+                      << " ms, p99 " << benchmarkCpuFrame.percentile(99) << " ms, gpu frame p50 " << benchmarkGpuFrame.percentile(50) << " ms, written to "
+                      << settings.benchmarkOutput << ".csv and .json" << std::endl;
+
+            if (!benchmarkCpuFramePaused.values.empty()) {
+                double recording = benchmarkCpuFrame.percentile(50);
+                double paused = benchmarkCpuFramePaused.percentile(50);
+                std::cout << "cpu profiling overhead: cpu frame p50 " << recording << " ms recording, " << paused << " ms paused, "
+                          << 100.0 * (recording - paused) / paused << "%" << std::endl;
+            }
+        }
+
+        //record, CPU frame and GPU frame time as the draw list grows, with the model matrix pushed and from the object ring
+        void benchmarkDrawScaling() {
+            const bool objectDataInRing = settings.objectDataInRing;
+
+            for (uint32_t drawCount : {1u, 10u, 100u, 1000u, 10000u, 100000u}) {
+                measureDrawScaling(drawCount, false);
+                //ring offsets baked into cached command buffers would point at overwritten data
+                if (!settings.cacheCommandBuffers) {
+                    measureDrawScaling(drawCount, true);
+                }
+            }
+
+            settings.objectDataInRing = objectDataInRing;
+        }
+
+        void measureDrawScaling(uint32_t drawCount, bool ring) {
+            const uint32_t warmupFrames = 60;
+
+            settings.objectDataInRing = ring;
+            settings.drawCount = drawCount;
+            buildDrawList();
+            invalidateCommandCache();
+
+            //the ring holds one ObjectData per draw, grow it for the larger draw list
+            if (drawList.size() > objectRingCapacity) {
+                recreateFrameResources(settings.framesInFlight);
+            }
+
+            waitForPipeline();
+            for (uint32_t i = 0; i < warmupFrames && windowOpen(); i++) {
+                pollEvents();
+                drawFrame();
+            }
+
+            recordTimings = TimingStats{};
+            frameTimings = TimingStats{};
+            gpuFrameTimings = TimingStats{};
+            uniformBytesWritten = TimingStats{};
+            for (uint32_t i = 0; i < settings.sweepFrames && windowOpen(); i++) {
+                pollEvents();
+                drawFrame();
+            }
+
+            double recordPerDraw = recordTimings.average() * 1000000.0 / drawCount;
+            size_t objectBytes = ring ? static_cast<size_t>(objectRing.bytesWritten) : drawCount * sizeof(PushConstants);
+            std::cout << drawCount << " draws (" << (ring ? "object ring" : "push constants") << "): record " << recordTimings.average() << " ms ("
+                      << recordPerDraw << " ns per draw), cpu frame " << frameTimings.average() << " ms, gpu frame " << gpuFrameTimings.average()
+                      << " ms, " << objectBytes + uniformBytesWritten.average() << " bytes written per frame";
+            if (ring) {
+                std::cout << " (" << objectRing.footprint() << " bytes of ring used)";
+            }
+            std::cout << std::endl;
+        }
+
+        //keep drawing until the selected pipeline variant has compiled, frames drawn with the fallback are not worth measuring
+        void waitForPipeline() {
+            auto compileStart = std::chrono::high_resolution_clock::now();
+            while (pipelineRegistry.request(activePipelineKey()) == VK_NULL_HANDLE && windowOpen() &&
+                   std::chrono::high_resolution_clock::now() - compileStart < std::chrono::seconds(10)) {
+                pollEvents();
+                drawFrame();
+            }
+        }
+
+        //CPU cost of giving every draw its own descriptor set, written fresh each time or deduplicated by the allocator cache,
+        //runs on a per-frame style allocator of its own, reset every simulated frame, without rendering so only allocation
+        //and vkUpdateDescriptorSets are timed
+        void benchmarkDescriptors() {
+            const uint32_t frames = 100;
+            uint32_t draws = std::max<uint32_t>(static_cast<uint32_t>(drawList.size()), 10000);
+
+            DescriptorAllocator allocator;
+            allocator.create(device, descriptorSetSizes(), 64);
+            std::vector<DescriptorWrite> writes = frameDescriptorWrites(0);
+
+            for (int cached = 0; cached < 2; cached++) {
+                uint64_t allocationsBefore = allocator.allocations;
+                auto start = std::chrono::high_resolution_clock::now();
+
+                for (uint32_t frame = 0; frame < frames; frame++) {
+                    allocator.reset();
+                    for (uint32_t draw = 0; draw < draws; draw++) {
+                        if (cached) {
+                            allocator.allocateCached(descriptorSetLayout, writes);
+                        } else {
+                            allocator.write(allocator.allocate(descriptorSetLayout), writes);
+                        }
+                    }
+                }
+
+                double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+                std::cout << "descriptor sets (" << (cached ? "write cache" : "allocate and write") << "): " << nanoseconds / (frames * draws) << " ns per draw at "
+                          << draws << " draws, " << (allocator.allocations - allocationsBefore) / frames << " allocations per frame, "
+                          << allocator.poolCount() << " pools" << std::endl;
+            }
+            allocator.destroy();
+        }
+
+        //GPU time of every quality tier, once with a pipeline specialised for it and once branching on ubo.featureFlags
+        void benchmarkSpecialization() {
+            if (!gpuProfiler.enabled()) {
+                std::cerr << "the graphics queue does not support timestamps, cannot benchmark shader variants" << std::endl;
+                return;
+            }
+
+            const uint32_t warmupFrames = 60;
+            const uint32_t tiers[] = {SHADER_FEATURE_TEXTURE, SHADER_FEATURE_TEXTURE | SHADER_FEATURE_VERTEX_COLOR, SHADER_FEATURE_VERTEX_COLOR};
+
+            for (uint32_t tier : tiers) {
+                double gpuTime[2] = {0.0, 0.0};
+
+                for (int dynamic = 0; dynamic < 2 && windowOpen(); dynamic++) {
+                    shaderFeatures = tier;
+                    dynamicShaderFeatures = dynamic == 1;
+
+                    waitForPipeline();
+
+                    for (uint32_t i = 0; i < warmupFrames && windowOpen(); i++) {
+                        pollEvents();
+                        drawFrame();
+                    }
+
+                    gpuFrameTimings = TimingStats{};
+                    for (uint32_t i = 0; i < settings.sweepFrames && windowOpen(); i++) {
+                        pollEvents();
+                        drawFrame();
+                    }
+                    gpuTime[dynamic] = gpuFrameTimings.average();
+                }
+
+                std::cout << "shader features " << tier << ": specialised " << gpuTime[0] << " ms, uniform branching " << gpuTime[1]
+                          << " ms GPU time per frame" << std::endl;
+            }
+        }
 
-        bool framebufferResized = false;
+        //render settings.sweepFrames frames with 1 to 4 frames in flight and report throughput and latency of each
+        void sweepFramesInFlight() {
+            const uint32_t warmupFrames = 60;
 
-        //initiates GLFW and creates a window
-        void initWindow(){
-            glfwInit();
-            
-            glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);                   //tells GLFW not to make OpenGL context (default)
+            for (uint32_t framesInFlight = 1; framesInFlight <= 4 && windowOpen(); framesInFlight++) {
+                recreateFrameResources(framesInFlight);
 
-            window = glfwCreateWindow(WIDTH,HEIGHT,"Vulkan",nullptr,nullptr);    //creates window
-            glfwSetWindowUserPointer(window, this);
-            glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
-        }
+                for (uint32_t i = 0; i < warmupFrames && windowOpen(); i++) {
+                    pollEvents();
+                    drawFrame();
+                }
 
-        //define callback function for when GLFWwindow is resized
-        static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
-            auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
-            app->framebufferResized = true;     
-        }
+                latencyTimings = TimingStats{};
+                auto start = std::chrono::high_resolution_clock::now();
+                uint32_t frames = 0;
 
-        //initiates all Vulkan objects
-        void initVulkan(){
-            createInstance();
-            setupDebugMessenger();
-            createSurface();
-            pickPhysicalDevice();
-            createLogicalDevice();
-            createSwapChain();
-            createImageViews();
-            createRenderPass();
-            createDescriptorSetLayout();
-            createGraphicsPipeline();
-            createCommandPool();
-            createDepthResources();
-            createFramebuffers();
-            createTextureImage();
-            createTextureImageView();
-            createTextureSampler();
-            loadModel();
-            createVertexBuffer();
-            createIndexBuffer();
-            createUniformBuffers();
-            createDescriptorPool();
-            createDescriptorSets();
-            createCommandBuffers();
-            createSyncObjects();
-        }
+                for (; frames < settings.sweepFrames && windowOpen(); frames++) {
+                    pollEvents();
+                    drawFrame();
+                }
 
-        //loop while window remains open
-        void mainLoop(){
-            while (!glfwWindowShouldClose(window)) {
-                glfwPollEvents();
-                drawFrame();
+                double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+                std::cout << "frames in flight " << framesInFlight << ": " << frames / seconds << " fps, " << latencyMetric() << " latency avg "
+                          << latencyTimings.average() << " ms (min " << latencyTimings.min << ", max " << latencyTimings.max << ")" << std::endl;
             }
-
-            vkDeviceWaitIdle(device);
         }
 
         //deallocate used resouces related to the swap chain
@@ -294,23 +3505,136 @@ class HelloTriangleApplication {
                 vkDestroyImageView(device, imageView, nullptr);
             }
 
-            vkDestroySwapchainKHR(device, swapChain, nullptr);
+            //headless runs own their images, the swap chain extension is not even enabled
+            if (settings.headless) {
+                for (size_t i = 0; i < swapChainImages.size(); i++) {
+                    vkDestroyImage(device, swapChainImages[i], nullptr);
+                    vkFreeMemory(device, offscreenImageMemory[i], nullptr);
+                }
+            } else {
+                vkDestroySwapchainKHR(device, swapChain, nullptr);
+            }
+        }
+
+        //deallocate everything that exists once per frame in flight, the device must be idle and the deletion queue flushed
+        void destroyFrameResources() {
+            if (objectRingBuffer != VK_NULL_HANDLE) {
+                vkDestroyBuffer(device, objectRingBuffer, nullptr);
+                vkFreeMemory(device, objectRingMemory, nullptr);
+                objectRingBuffer = VK_NULL_HANDLE;
+            }
+
+            gpuProfiler.destroy();
+            pipelineStatistics.destroy();
+
+            for (size_t i = 0; i < uniformBuffers.size(); i++) {
+                vkDestroyBuffer(device, uniformBuffers[i], nullptr);
+                vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+            }
+
+            descriptorAllocator.destroy();
+            for (auto& allocator : frameDescriptorAllocators) {
+                allocator.destroy();
+            }
+            frameDescriptorAllocators.clear();
+
+            for (size_t i = 0; i < inFlightFences.size(); i++) {
+                vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
+                vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
+                vkDestroyFence(device, inFlightFences[i], nullptr);
+            }
+
+            for (auto& pool : frameCommandPools) {
+                pool.destroy();
+            }
+            for (auto& framePools : recordCommandPools) {
+                for (auto& pool : framePools) {
+                    pool.destroy();
+                }
+            }
+            frameCommandPools.clear();
+            recordCommandPools.clear();
+
+            if (cachedCommandPool != VK_NULL_HANDLE) {
+                vkDestroyCommandPool(device, cachedCommandPool, nullptr);
+                cachedCommandPool = VK_NULL_HANDLE;
+            }
+            cachedCommandBuffers.clear();
+        }
+
+        //rebuild every per-frame resource for a different number of frames in flight (waits for the device to idle)
+        void recreateFrameResources(uint32_t framesInFlight) {
+            vkDeviceWaitIdle(device);
+            deletionQueue.flushAll();
+
+            destroyFrameResources();
+
+            settings.framesInFlight = framesInFlight;
+            currentFrame = 0;
+            frameNumberInFlight.clear();
+            frameSubmitLatency.clear();
+            completedFrameNumber = frameNumber;
+
+            createUniformBuffers();
+            createDescriptorAllocators();
+            createDescriptorSets();
+            createFrameCommandPools();
+            createSyncObjects();
+            createGpuProfiler();
+            createPipelineStatistics();
+        }
+
+        //hand swap chain resources to the deletion queue, they are destroyed once the last frame using them has finished
+        void retireSwapChain() {
+            VkMemoryRequirements depthRequirements;
+            vkGetImageMemoryRequirements(device, depthImage, &depthRequirements);
+
+            VkImageView oldDepthImageView = depthImageView;
+            VkImage oldDepthImage = depthImage;
+            VkDeviceMemory oldDepthImageMemory = depthImageMemory;
+            std::vector<VkFramebuffer> oldFramebuffers = swapChainFramebuffers;
+            std::vector<VkImageView> oldImageViews = swapChainImageViews;
+            VkSwapchainKHR oldSwapChain = swapChain;
+
+            deletionQueue.push(frameNumber, depthRequirements.size, [=]() {
+                vkDestroyImageView(device, oldDepthImageView, nullptr);
+                vkDestroyImage(device, oldDepthImage, nullptr);
+                vkFreeMemory(device, oldDepthImageMemory, nullptr);
+
+                for (auto framebuffer : oldFramebuffers) {
+                    vkDestroyFramebuffer(device, framebuffer, nullptr);
+                }
+
+                for (auto imageView : oldImageViews) {
+                    vkDestroyImageView(device, imageView, nullptr);
+                }
+
+                vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+            });
         }
 
         //deallocate used resources
         void cleanup(){
+            if (deletionQueue.deferredTotal() > 0) {
+                std::cout << "deletion queue: " << deletionQueue.deferredTotal() << " deferred destroys, " << deletionQueue.pendingDeletions()
+                          << " pending at shutdown holding " << deletionQueue.bytesHeld() << " bytes" << std::endl;
+            }
+            deletionQueue.flushAll();
+
             cleanupSwapChain();
         
-            vkDestroyPipeline(device, graphicsPipeline, nullptr);
-            vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-            vkDestroyRenderPass(device, renderPass, nullptr);
+#ifdef SHADER_HOT_RELOAD
+            shaderReloadThread.reset();
+            std::cout << "shader compiler: " << shaderCompiler->compiles << " compiles, " << shaderCompiler->cacheHits << " served from the SPIR-V cache" << std::endl;
+#endif
+            pipelineRegistry.printStats();
+            pipelineRegistry.destroy();
 
-            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-            vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
-            }
+            savePipelineCache();
+            vkDestroyPipelineCache(device, pipelineCache, nullptr);
+            vkDestroyRenderPass(device, renderPass, nullptr);
 
-            vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+            destroyFrameResources();
 
             vkDestroySampler(device, textureSampler, nullptr);
             vkDestroyImageView(device, textureImageView, nullptr);
@@ -318,7 +3642,7 @@ class HelloTriangleApplication {
             vkDestroyImage(device, textureImage, nullptr);
             vkFreeMemory(device, textureImageMemory, nullptr);
 
-            vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+            layoutCache.destroy();
 
             vkDestroyBuffer(device, indexBuffer, nullptr);
             vkFreeMemory(device, indexBufferMemory, nullptr);
@@ -326,13 +3650,72 @@ class HelloTriangleApplication {
             vkDestroyBuffer(device, vertexBuffer, nullptr);
             vkFreeMemory(device, vertexBufferMemory, nullptr);
 
-            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-                vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-                vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-                vkDestroyFence(device, inFlightFences[i], nullptr);
+            vkDestroyCommandPool(device, commandPool, nullptr);
+
+            if (recordTimings.count > 0) {
+                std::cout << "command recording: " << drawList.size() << " draws in " << (settings.recordThreads > 0 ? settings.recordThreads : 1)
+                          << " command buffer(s) on " << (settings.recordThreads > 0 ? jobSystem->threadCount() : 1) << " thread(s), avg " << recordTimings.average() << " ms (min " << recordTimings.min << ", max " << recordTimings.max
+                          << ") over " << recordTimings.count << " frames" << std::endl;
             }
 
-            vkDestroyCommandPool(device, commandPool, nullptr);
+            if (gpuFrameTimings.count > 0) {
+                std::cout << "gpu frame time: avg " << gpuFrameTimings.average() << " ms (min " << gpuFrameTimings.min << ", max " << gpuFrameTimings.max << ")" << std::endl;
+            }
+
+            if (pipelineCounterStats[0].count > 0) {
+                std::cout << "pipeline statistics per frame:";
+                for (size_t i = 0; i < PIPELINE_COUNTER_NAMES.size(); i++) {
+                    std::cout << " " << PIPELINE_COUNTER_NAMES[i] << " " << pipelineCounterStats[i].average();
+                }
+                std::cout << std::endl;
+                writePipelineStatisticsReport();
+            }
+
+            std::vector<std::string> gpuScopes = gpuProfiler.scopeNames();
+            for (const auto& scope : gpuScopes) {
+                GpuScopeStats stats = *gpuProfiler.stats(scope);
+                std::cout << "gpu scope " << scope << " (last " << GpuProfiler::ROLLING_FRAMES << " frames): avg " << stats.average << " ms (min "
+                          << stats.min << ", max " << stats.max << ")" << std::endl;
+            }
+            if (!gpuScopes.empty()) {
+                gpuProfiler.writeJson(settings.gpuProfilePath);
+            }
+
+            if (uniformUpdateTimings.count > 0) {
+                std::cout << "uniform updates: avg " << uniformUpdateTimings.average() << " us, avg " << uniformBytesWritten.average() << " bytes written per frame (max "
+                          << uniformBytesWritten.max << ", full buffer " << sizeof(UniformBufferObject) << ")" << std::endl;
+            }
+
+            if (frameTimings.count > 0) {
+                std::cout << "cpu frame time (" << (settings.cacheCommandBuffers ? "cached command buffers" : "recorded every frame") << "): avg "
+                          << frameTimings.average() << " ms (min " << frameTimings.min << ", max " << frameTimings.max << ")";
+                if (settings.cacheCommandBuffers) {
+                    std::cout << ", " << cachedModelRerecords << " cached buffers recorded again for model changes";
+                }
+                std::cout << std::endl;
+            }
+
+            if (!settings.headless) {
+                //one line per present mode used, to compare them within a run switched with M
+                for (const auto& [presentMode, intervals] : presentModeIntervals) {
+                    std::cout << "present mode " << presentModeName(presentMode) << ": " << intervals.count << " frames, " << 1000.0 / intervals.average() << " fps, " << latencyMetric() << " latency avg "
+                              << presentModeLatencies[presentMode].average() << " ms" << std::endl;
+                }
+
+                const char* mode = settings.singleThread ? "single thread" : "render thread";
+                for (const auto& [series, name] : {std::pair<const SampleSeries*, const char*>{&framePacing, "steady"}, {&interactionPacing, "drag/resize"}}) {
+                    if (!series->values.empty()) {
+                        std::cout << "frame pacing (" << mode << ", " << name << "): " << series->values.size() << " frames, mean " << series->mean() << " ms, stddev "
+                                  << series->standardDeviation() << " ms, p99 " << series->percentile(99.0) << " ms, max " << series->percentile(100.0) << " ms" << std::endl;
+                    }
+                }
+            }
+
+            jobSystem.reset();
+
+#ifdef CPU_PROFILING
+            writeCpuTrace();
+#endif
 
             vkDestroyDevice(device, nullptr);
 
@@ -340,26 +3723,56 @@ class HelloTriangleApplication {
                 DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
             }
 
-            vkDestroySurfaceKHR(instance, surface, nullptr);
+            if (surface != VK_NULL_HANDLE) {
+                vkDestroySurfaceKHR(instance, surface, nullptr);
+            }
             vkDestroyInstance(instance, nullptr);
 
-            glfwDestroyWindow(window);
+            if (window != nullptr) {
+                glfwDestroyWindow(window);
 
-            glfwTerminate();
+                glfwTerminate();
+            }
         }
 
-        //recreate objects related to the swap chain
-        void recreateSwapChain() {
-            int width = 0, height = 0;
-            glfwGetFramebufferSize(window, &width, &height);
-            while (width == 0 || height == 0) {
-                glfwGetFramebufferSize(window, &width, &height);
-                glfwWaitEvents();
+#ifdef CPU_PROFILING
+        //dump the CPU trace, every worker has been joined by now, with the events and buffer memory of each thread,
+        //what recording costs a frame is measured by --benchmark
+        void writeCpuTrace() {
+            CpuProfiler& profiler = CpuProfiler::instance();
+            profiler.writeChromeTrace(settings.cpuTracePath);
+
+            std::vector<CpuProfiler::ThreadStats> stats = profiler.threadStats();
+            uint64_t recorded = 0, dropped = 0;
+            for (const auto& thread : stats) {
+                recorded += thread.recorded;
+                dropped += thread.dropped;
             }
+            std::cout << "cpu trace: " << recorded << " events on " << stats.size() << " threads (" << dropped << " dropped), written to "
+                      << settings.cpuTracePath << std::endl;
 
-            vkDeviceWaitIdle(device);
+            for (const auto& thread : stats) {
+                std::cout << "  " << thread.name << " (thread " << thread.threadId << "): " << thread.recorded << " events over " << thread.lifetime / 1e9
+                          << " s, " << thread.allocatedBytes / 1024 << " KB of buffers" << std::endl;
+            }
+        }
+#endif
 
-            cleanupSwapChain();
+        //recreate objects related to the swap chain, the old objects are retired instead of waiting for the device to idle
+        void recreateSwapChain() {
+            CPU_PROFILE_FUNCTION();
+
+            //minimised, wait for a resize event with a real size
+            while ((framebufferWidth == 0 || framebufferHeight == 0) && windowOpen()) {
+                waitForWindowEvents(IDLE_WAIT_TIMEOUT);
+            }
+            if (!windowOpen()) {
+                return;
+            }
+
+            pendingPresents.clear();    //timings are queried per swap chain, the retired one's are not reported any more
+            retireSwapChain();
+            invalidateCommandCache();
 
             createSwapChain();
             createImageViews();
@@ -369,6 +3782,8 @@ class HelloTriangleApplication {
 
         //create VkInstance
         void createInstance(){
+            CPU_PROFILE_FUNCTION();
+
             if (enableValidationLayers && !checkValidationLayerSupport()){
                 throw std::runtime_error("validation layers requested, but not available!");
             }
@@ -435,6 +3850,8 @@ class HelloTriangleApplication {
 
         //create VkDebugUtilsMessengerEXT
         void setupDebugMessenger() {
+            CPU_PROFILE_FUNCTION();
+
             if (!enableValidationLayers) return;
 
             VkDebugUtilsMessengerCreateInfoEXT createInfo;
@@ -447,6 +3864,8 @@ class HelloTriangleApplication {
         
         //create VkSurfaceKHR
         void createSurface() {
+            CPU_PROFILE_FUNCTION();
+
             if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
                 throw std::runtime_error("failed to create window surface!");
             }
@@ -454,6 +3873,8 @@ class HelloTriangleApplication {
 
         //go through all graphics cards and pick first suitable
         void pickPhysicalDevice() {
+            CPU_PROFILE_FUNCTION();
+
         uint32_t deviceCount = 0;
         vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
 
@@ -478,6 +3899,8 @@ class HelloTriangleApplication {
 
         //create VkDevice and its queues
         void createLogicalDevice() {
+            CPU_PROFILE_FUNCTION();
+
             QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
             std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
@@ -497,6 +3920,23 @@ class HelloTriangleApplication {
 
             deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+            //statistics queries are optional, they are turned off on devices that cannot run them
+            if (settings.pipelineStatistics) {
+                VkPhysicalDeviceFeatures supportedFeatures;
+                vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+                if (!supportedFeatures.pipelineStatisticsQuery || (settings.recordThreads > 0 && !supportedFeatures.inheritedQueries)) {
+                    std::cerr << "the device does not support pipeline statistics queries" << (settings.recordThreads > 0 ? " in secondary command buffers" : "")
+                              << ", --pipeline-stats is ignored" << std::endl;
+                    settings.pipelineStatistics = false;
+                    settings.benchmarkPipelineStatistics = false;
+                } else {
+                    deviceFeatures.pipelineStatisticsQuery = VK_TRUE;
+                    deviceFeatures.inheritedQueries = supportedFeatures.inheritedQueries;
+                    deviceFeatures.occlusionQueryPrecise = supportedFeatures.occlusionQueryPrecise;
+                }
+            }
+
             VkDeviceCreateInfo createInfo{};
             createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 
@@ -505,8 +3945,13 @@ class HelloTriangleApplication {
 
             createInfo.pEnabledFeatures = &deviceFeatures;
 
-            createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-            createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+            std::vector<const char*> extensions = requiredDeviceExtensions();
+            bool displayTiming = !settings.headless && deviceSupportsExtension(physicalDevice, VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
+            if (displayTiming) {
+                extensions.push_back(VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
+            }
+            createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+            createInfo.ppEnabledExtensionNames = extensions.data();
 
             if (enableValidationLayers) {
                 createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -521,17 +3966,29 @@ class HelloTriangleApplication {
 
             vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
             vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+            if (displayTiming) {
+                getPastPresentationTiming = reinterpret_cast<PFN_vkGetPastPresentationTimingGOOGLE>(vkGetDeviceProcAddr(device, "vkGetPastPresentationTimingGOOGLE"));
+            }
         }
 
-        //create VkSwapchainKHR
+        //create VkSwapchainKHR, headless runs get offscreen images instead
         void createSwapChain() {
+            CPU_PROFILE_FUNCTION();
+
+            if (settings.headless) {
+                createOffscreenImages();
+                return;
+            }
+
             SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
             VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
             VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
             VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 
-            uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+            uint32_t imageCount = settings.swapchainImages > 0 ? settings.swapchainImages : swapChainSupport.capabilities.minImageCount + 1;
+            imageCount = std::max(imageCount, swapChainSupport.capabilities.minImageCount);
             if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
                 imageCount = swapChainSupport.capabilities.maxImageCount;
             }
@@ -563,7 +4020,7 @@ class HelloTriangleApplication {
             createInfo.presentMode = presentMode;
             createInfo.clipped = VK_TRUE;
 
-            createInfo.oldSwapchain = VK_NULL_HANDLE;
+            createInfo.oldSwapchain = swapChain;    //VK_NULL_HANDLE on first creation, retired swap chain when recreating
 
             if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
                 throw std::runtime_error("failed to create swap chain!");
@@ -575,12 +4032,85 @@ class HelloTriangleApplication {
             swapChainImages.resize(imageCount);
             vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
 
+            if (presentMode != swapChainPresentMode) {
+                std::cout << "present mode " << presentModeName(presentMode) << " (" << settings.presentPolicy << ")" << std::endl;
+            }
+
             swapChainImageFormat = surfaceFormat.format;
             swapChainExtent = extent;
+            swapChainPresentMode = presentMode;
+        }
+
+        //colour images in the first 8 bit sRGB format the device can render to and copy from, with the window's size,
+        //rendered in turn and copyable for saveOffscreenImage
+        void createOffscreenImages() {
+            //devices before Vulkan 1.1 do not report transfer support, it is implied for every format they support
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+            VkFormatFeatureFlags features = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT;
+            if (properties.apiVersion >= VK_API_VERSION_1_1) {
+                features |= VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+            }
+            swapChainImageFormat = findSupportedFormat({VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R8G8B8A8_SRGB}, VK_IMAGE_TILING_OPTIMAL, features);
+            swapChainExtent = {settings.width, settings.height};
+
+            swapChainImages.resize(HEADLESS_IMAGE_COUNT);
+            offscreenImageMemory.resize(HEADLESS_IMAGE_COUNT);
+            for (uint32_t i = 0; i < HEADLESS_IMAGE_COUNT; i++) {
+                createImage(swapChainExtent.width, swapChainExtent.height, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+                            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            swapChainImages[i], offscreenImageMemory[i]);
+            }
+        }
+
+        //copy the image of the last frame to host memory and write it as a binary PPM, the device must be idle
+        void saveOffscreenImage(const std::string& path) {
+            VkDeviceSize imageSize = static_cast<VkDeviceSize>(swapChainExtent.width) * swapChainExtent.height * 4;
+
+            VkBuffer readbackBuffer;
+            VkDeviceMemory readbackBufferMemory;
+            createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffer, readbackBufferMemory);
+
+            //the render pass leaves the image in TRANSFER_SRC_OPTIMAL
+            VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+            VkBufferImageCopy region{};
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.layerCount = 1;
+            region.imageExtent = {swapChainExtent.width, swapChainExtent.height, 1};
+            vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[lastImageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+            endSingleTimeCommands(commandBuffer);
+
+            void* data;
+            vkMapMemory(device, readbackBufferMemory, 0, imageSize, 0, &data);
+            const uint8_t* pixels = static_cast<const uint8_t*>(data);
+
+            //PPM is RGB, BGRA images have red and blue swapped
+            size_t red = swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB ? 2 : 0;
+            size_t blue = 2 - red;
+
+            std::ofstream file(path, std::ios::binary);
+            file << "P6\n" << swapChainExtent.width << " " << swapChainExtent.height << "\n255\n";
+            for (VkDeviceSize i = 0; i < imageSize; i += 4) {
+                const char rgb[] = {static_cast<char>(pixels[i + red]), static_cast<char>(pixels[i + 1]), static_cast<char>(pixels[i + blue])};
+                file.write(rgb, sizeof(rgb));
+            }
+
+            vkUnmapMemory(device, readbackBufferMemory);
+            vkDestroyBuffer(device, readbackBuffer, nullptr);
+            vkFreeMemory(device, readbackBufferMemory, nullptr);
+
+            if (!file) {
+                throw std::runtime_error("failed to write " + path + "!");
+            }
+            std::cout << "wrote frame " << frameNumber << " to " << path << std::endl;
         }
 
         //creates VkImageView for each swap chain VkImage handle
         void createImageViews() {
+            CPU_PROFILE_FUNCTION();
+
             swapChainImageViews.resize(swapChainImages.size());
 
         for (uint32_t i = 0; i < swapChainImages.size(); i++) {
@@ -590,6 +4120,8 @@ class HelloTriangleApplication {
 
         //create renderpass
         void createRenderPass() {
+            CPU_PROFILE_FUNCTION();
+
             VkAttachmentDescription colorAttachment{};
             colorAttachment.format = swapChainImageFormat;
             colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -598,7 +4130,7 @@ class HelloTriangleApplication {
             colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
             colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
             colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+            colorAttachment.finalLayout = settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
             VkAttachmentDescription depthAttachment{};
             depthAttachment.format = findDepthFormat();
@@ -632,6 +4164,16 @@ class HelloTriangleApplication {
             dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
             dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
+            //headless images are read back by saveOffscreenImage's copy, which has to see the colour writes
+            VkSubpassDependency readbackDependency{};
+            readbackDependency.srcSubpass = 0;
+            readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+            readbackDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            readbackDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            readbackDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            readbackDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+            std::array<VkSubpassDependency, 2> dependencies = {dependency, readbackDependency};
             std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
 
             VkRenderPassCreateInfo renderPassInfo{};
@@ -640,49 +4182,100 @@ class HelloTriangleApplication {
             renderPassInfo.pAttachments = attachments.data();
             renderPassInfo.subpassCount = 1;
             renderPassInfo.pSubpasses = &subpass;
-            renderPassInfo.dependencyCount = 1;
-            renderPassInfo.pDependencies = &dependency;
+            renderPassInfo.dependencyCount = settings.headless ? 2 : 1;
+            renderPassInfo.pDependencies = dependencies.data();
 
             if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
                 throw std::runtime_error("failed to create render pass!");
             }
         }
         
-        //create descriptor set layout
+        //generate the descriptor set layouts from the reflected shader interface
         void createDescriptorSetLayout() {
-            VkDescriptorSetLayoutBinding uboLayoutBinding{};
-            uboLayoutBinding.binding = 0;
-            uboLayoutBinding.descriptorCount = 1;
-            uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            uboLayoutBinding.pImmutableSamplers = nullptr;
-            uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-            VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-            samplerLayoutBinding.binding = 1;
-            samplerLayoutBinding.descriptorCount = 1;
-            samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            samplerLayoutBinding.pImmutableSamplers = nullptr;
-            samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-            std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding, samplerLayoutBinding};
+            CPU_PROFILE_FUNCTION();
 
-            VkDescriptorSetLayoutCreateInfo layoutInfo{};
-            layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-            layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-            layoutInfo.pBindings = bindings.data();
+            shaderInterface = reflectShaders(*shaderBinaries);
 
-            if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create descriptor set layout!");
+            layoutCache.create(device);
+
+            //sets the shaders skip still need a (empty) layout so later set numbers line up
+            uint32_t setCount = shaderInterface.sets.empty() ? 1 : shaderInterface.sets.rbegin()->first + 1;
+            descriptorSetLayouts.clear();
+            for (uint32_t set = 0; set < setCount; set++) {
+                descriptorSetLayouts.push_back(layoutCache.getSetLayout(shaderInterface.sets[set]));
+            }
+            descriptorSetLayout = descriptorSetLayouts[0];
+        }
+
+        //read the interface of both stages and check the vertex inputs against the Vertex struct
+        ShaderInterface reflectShaders(const ShaderBinaries& shaders) {
+            ShaderInterface reflected = reflectSpirv(shaders.vert);
+            reflected.merge(reflectSpirv(shaders.frag));
+
+            //SPIR-V cannot tell a dynamic uniform buffer from a plain one, the object data takes a dynamic offset per draw
+            for (auto& binding : reflected.sets[0]) {
+                if (binding.binding == OBJECT_DATA_BINDING && binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+                    binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+                }
+            }
+
+            auto attributeDescriptions = Vertex::getAttributeDescriptions();
+            for (auto& input : reflected.vertexInputs) {
+                auto attribute = std::find_if(attributeDescriptions.begin(), attributeDescriptions.end(),
+                    [&](const VkVertexInputAttributeDescription& a) { return a.location == input.location; });
+                if (attribute == attributeDescriptions.end()) {
+                    throw std::runtime_error("vertex shader reads location " + std::to_string(input.location) + " which Vertex does not provide!");
+                }
+                if (attribute->format != input.format) {
+                    throw std::runtime_error("vertex shader input at location " + std::to_string(input.location) + " does not match the Vertex attribute format!");
+                }
             }
+
+            return reflected;
         }
 
         //create graphics pipeline
         void createGraphicsPipeline() {
-            auto vertShaderCode = readFile("../src/07-LoadingModels/shaders/vert.spv");
-            auto fragShaderCode = readFile("../src/07-LoadingModels/shaders/frag.spv");
+            CPU_PROFILE_FUNCTION();
+
+            if (shaderInterface.pushConstantRanges.empty() || shaderInterface.pushConstantRanges[0].size < sizeof(PushConstants)) {
+                throw std::runtime_error("shader push constant block does not match PushConstants!");
+            }
+            pipelineLayout = layoutCache.getPipelineLayout(descriptorSetLayouts, shaderInterface.pushConstantRanges);
+
+            auto pipelineStart = std::chrono::high_resolution_clock::now();
+
+            //the default pipeline matches the startup settings so it can stand in for them while variants compile
+            PipelineKey defaultKey{};
+            if (settings.objectDataInRing) {
+                defaultKey.shaderFeatures |= SHADER_FEATURE_OBJECT_BUFFER;
+            }
+            defaultPipelineKey = defaultKey;
+            graphicsPipeline = buildGraphicsPipeline(defaultKey, *currentShaderBinaries());
+
+            double pipelineTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pipelineStart).count();
+            std::cout << "graphics pipeline created in " << pipelineTime << " ms (" << (pipelineCacheWarm ? "warm" : "cold") << " pipeline cache)" << std::endl;
+
+            //variants are compiled in the background the first time they are selected
+            pipelineRegistry.create(device, 1, [this](const PipelineKey& key) { return buildGraphicsPipeline(key, *currentShaderBinaries()); });
+            pipelineRegistry.insert(defaultKey, graphicsPipeline);
+
+            PipelineKey noCull{};
+            noCull.cullMode = VK_CULL_MODE_NONE;
+            PipelineKey frontCull{};
+            frontCull.cullMode = VK_CULL_MODE_FRONT_BIT;
+            PipelineKey blended{};
+            blended.blendEnable = VK_TRUE;
+            blended.depthWriteEnable = VK_FALSE;
+            pipelineVariants = {defaultKey, noCull, frontCull, blended};
+        }
+
+        //compile the graphics pipeline for one variant, called from pipeline registry and shader reload threads
+        VkPipeline buildGraphicsPipeline(const PipelineKey& key, const ShaderBinaries& shaders) {
+            CPU_PROFILE_FUNCTION();
 
-            VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-            VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+            VkShaderModule vertShaderModule = createShaderModule(shaders.vert.data(), shaders.vert.size() * sizeof(uint32_t));
+            VkShaderModule fragShaderModule = createShaderModule(shaders.frag.data(), shaders.frag.size() * sizeof(uint32_t));
 
             VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
             vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -696,6 +4289,28 @@ class HelloTriangleApplication {
             fragShaderStageInfo.module = fragShaderModule;
             fragShaderStageInfo.pName = "main";
 
+            //every variant shares one SPIR-V module, the driver folds the constants and drops the disabled paths
+            std::array<VkBool32, 4> specializationData = {
+                (key.shaderFeatures & SHADER_FEATURE_TEXTURE) ? VK_TRUE : VK_FALSE,
+                (key.shaderFeatures & SHADER_FEATURE_VERTEX_COLOR) ? VK_TRUE : VK_FALSE,
+                (key.shaderFeatures & SHADER_FEATURE_DYNAMIC) ? VK_TRUE : VK_FALSE,
+                (key.shaderFeatures & SHADER_FEATURE_OBJECT_BUFFER) ? VK_TRUE : VK_FALSE
+            };
+            std::array<VkSpecializationMapEntry, 4> specializationEntries{};
+            for (uint32_t i = 0; i < specializationEntries.size(); i++) {
+                specializationEntries[i].constantID = i;
+                specializationEntries[i].offset = i * sizeof(VkBool32);
+                specializationEntries[i].size = sizeof(VkBool32);
+            }
+
+            VkSpecializationInfo specializationInfo{};
+            specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+            specializationInfo.pMapEntries = specializationEntries.data();
+            specializationInfo.dataSize = sizeof(specializationData);
+            specializationInfo.pData = specializationData.data();
+            vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
+            fragShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
             VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
             VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
@@ -711,7 +4326,7 @@ class HelloTriangleApplication {
 
             VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
             inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-            inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+            inputAssembly.topology = key.topology;
             inputAssembly.primitiveRestartEnable = VK_FALSE;
 
             VkPipelineViewportStateCreateInfo viewportState{};
@@ -725,8 +4340,8 @@ class HelloTriangleApplication {
             rasterizer.rasterizerDiscardEnable = VK_FALSE;
             rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
             rasterizer.lineWidth = 1.0f;
-            rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-            rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+            rasterizer.cullMode = key.cullMode;
+            rasterizer.frontFace = key.frontFace;
             rasterizer.depthBiasEnable = VK_FALSE;
 
             VkPipelineMultisampleStateCreateInfo multisampling{};
@@ -737,14 +4352,20 @@ class HelloTriangleApplication {
             VkPipelineDepthStencilStateCreateInfo depthStencil{};
             depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
             depthStencil.depthTestEnable = VK_TRUE;
-            depthStencil.depthWriteEnable = VK_TRUE;
+            depthStencil.depthWriteEnable = key.depthWriteEnable;
             depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
             depthStencil.depthBoundsTestEnable = VK_FALSE;
             depthStencil.stencilTestEnable = VK_FALSE;
 
             VkPipelineColorBlendAttachmentState colorBlendAttachment{};
             colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-            colorBlendAttachment.blendEnable = VK_FALSE;
+            colorBlendAttachment.blendEnable = key.blendEnable;
+            colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+            colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+            colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+            colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+            colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 
             VkPipelineColorBlendStateCreateInfo colorBlending{};
             colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
@@ -766,15 +4387,6 @@ class HelloTriangleApplication {
             dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
             dynamicState.pDynamicStates = dynamicStates.data();
 
-            VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-            pipelineLayoutInfo.setLayoutCount = 1;
-            pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-
-            if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create pipeline layout!");
-            }
-
             VkGraphicsPipelineCreateInfo pipelineInfo{};
             pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
             pipelineInfo.stageCount = 2;
@@ -793,17 +4405,228 @@ class HelloTriangleApplication {
             pipelineInfo.subpass = 0;
             pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-            if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create graphics pipeline!");
+            VkPipeline pipeline;
+            VkResult result = vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
+
+            vkDestroyShaderModule(device, fragShaderModule, nullptr);
+            vkDestroyShaderModule(device, vertShaderModule, nullptr);
+
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("failed to create graphics pipeline!");
+            }
+
+            return pipeline;
+        }
+
+        std::shared_ptr<const ShaderBinaries> currentShaderBinaries() {
+            std::lock_guard<std::mutex> lock(shaderBinariesMutex);
+            return shaderBinaries;
+        }
+
+        //use the SPIR-V embedded at build time, hot reload builds compile the sources instead so edits made since the build show up
+        void loadShaders() {
+            CPU_PROFILE_FUNCTION();
+
+            auto binaries = std::make_shared<ShaderBinaries>();
+            binaries->vert.assign(std::begin(VERT_SHADER_CODE), std::end(VERT_SHADER_CODE));
+            binaries->frag.assign(std::begin(FRAG_SHADER_CODE), std::end(FRAG_SHADER_CODE));
+
+#ifdef SHADER_HOT_RELOAD
+            auto compileStart = std::chrono::high_resolution_clock::now();
+
+            shaderCompiler = std::make_unique<ShaderCompiler>("shader_cache");
+            try {
+                binaries = compileShaderSources();
+            } catch (const std::runtime_error& e) {
+                std::cerr << "shader compile failed, using the shaders embedded at build time:\n" << e.what() << std::endl;
+            }
+
+            double compileTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - compileStart).count();
+            std::cout << "shaders loaded from " << SHADER_SOURCE_DIR << " in " << compileTime << " ms (" << shaderCompiler->cacheHits << " from the SPIR-V cache)" << std::endl;
+
+            shaderWatcher = std::make_unique<ShaderWatcher>(SHADER_SOURCE_DIR);
+            shaderReloadThread = std::make_unique<ThreadPool>(1, "shader reload");
+#endif
+
+            shaderBinaries = binaries;
+        }
+
+#ifdef SHADER_HOT_RELOAD
+        std::shared_ptr<ShaderBinaries> compileShaderSources() {
+            auto binaries = std::make_shared<ShaderBinaries>();
+            binaries->vert = shaderCompiler->compile(std::string(SHADER_SOURCE_DIR) + "/shader.vert", shaderc_glsl_vertex_shader);
+            binaries->frag = shaderCompiler->compile(std::string(SHADER_SOURCE_DIR) + "/shader.frag", shaderc_glsl_fragment_shader);
+            return binaries;
+        }
+
+        //recompile the shaders and rebuild every pipeline on the reload thread, the results are swapped in by applyShaderReload
+        void reloadShaders() {
+            CPU_PROFILE_FUNCTION();
+
+            auto reloadStart = std::chrono::high_resolution_clock::now();
+
+            std::shared_ptr<ShaderBinaries> binaries;
+            try {
+                binaries = compileShaderSources();
+                if (!reflectShaders(*binaries).sameLayout(shaderInterface)) {
+                    throw std::runtime_error("the shader interface changed, descriptor sets cannot be rebuilt while running, restart to apply");
+                }
+            } catch (const std::runtime_error& e) {
+                std::cerr << "shader reload failed, keeping the current pipelines:\n" << e.what() << std::endl;
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(shaderBinariesMutex);
+                shaderBinaries = binaries;
+            }
+
+            uint32_t rebuilt = 0;
+            for (const PipelineKey& key : pipelineRegistry.keys()) {
+                try {
+                    pipelineRegistry.queueReplacement(key, buildGraphicsPipeline(key, *binaries));
+                    rebuilt++;
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "pipeline rebuild failed: " << e.what() << std::endl;
+                }
+            }
+
+            double reloadTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - reloadStart).count();
+            std::cout << "shaders reloaded, " << rebuilt << " pipelines rebuilt in " << reloadTime << " ms" << std::endl;
+        }
+#endif
+
+        //start a reload when a shader source changed and swap in pipelines that finished rebuilding, replaced
+        //pipelines go to the deletion queue since frames in flight may still use them
+        void applyShaderReload() {
+#ifdef SHADER_HOT_RELOAD
+            if (shaderWatcher->poll()) {
+                shaderReloadThread->submit([this]() { reloadShaders(); });
+            }
+#endif
+
+            pipelineRegistry.applyReplacements([this](const PipelineKey& key, VkPipeline oldPipeline, VkPipeline newPipeline) {
+                redrawRequested = true;
+                if (key == defaultPipelineKey) {
+                    graphicsPipeline = newPipeline;
+                }
+                if (oldPipeline != VK_NULL_HANDLE) {
+                    deletionQueue.push(frameNumber, 0, [this, oldPipeline]() {
+                        vkDestroyPipeline(device, oldPipeline, nullptr);
+                    });
+                }
+            });
+        }
+
+        //read the pipeline cache file, returns no data if it is missing or was written by another device or driver
+        std::vector<char> loadPipelineCacheData() {
+            std::ifstream file(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+            if (!file.is_open()) {
+                return {};
+            }
+
+            size_t fileSize = (size_t) file.tellg();
+            if (fileSize < sizeof(PipelineCacheFileHeader) + sizeof(VkPipelineCacheHeaderVersionOne)) {
+                return {};
+            }
+
+            PipelineCacheFileHeader header{};
+            file.seekg(0);
+            file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+            if (header.magic != PIPELINE_CACHE_MAGIC || header.dataSize != fileSize - sizeof(header) || header.vendorID != properties.vendorID ||
+                header.deviceID != properties.deviceID || header.driverVersion != properties.driverVersion ||
+                memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+                std::cout << "pipeline cache file does not match this device or driver, starting cold" << std::endl;
+                return {};
+            }
+
+            std::vector<char> data(header.dataSize);
+            file.read(data.data(), data.size());
+
+            //the driver checks its own header as well, but a mismatch there would silently give an empty cache
+            VkPipelineCacheHeaderVersionOne driverHeader;
+            memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+            if (!file || driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || driverHeader.vendorID != properties.vendorID ||
+                driverHeader.deviceID != properties.deviceID || memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+                std::cout << "pipeline cache data is corrupt, starting cold" << std::endl;
+                return {};
+            }
+
+            return data;
+        }
+
+        //create the pipeline cache, seeded from disk when a compatible cache file exists
+        void createPipelineCache() {
+            CPU_PROFILE_FUNCTION();
+
+            std::vector<char> initialData;
+            if (!settings.coldPipelineCache) {
+                initialData = loadPipelineCacheData();
+            }
+
+            VkPipelineCacheCreateInfo cacheInfo{};
+            cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+            cacheInfo.initialDataSize = initialData.size();
+            cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+            if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create pipeline cache!");
             }
 
+            pipelineCacheWarm = !initialData.empty();
+        }
 
-            vkDestroyShaderModule(device, fragShaderModule, nullptr);
-            vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        //write the pipeline cache to a temporary file and rename it over the old one, so a crash never leaves a torn file
+        void savePipelineCache() {
+            size_t dataSize = 0;
+            if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+                return;
+            }
+
+            std::vector<char> data(dataSize);
+            if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+                std::cerr << "failed to read pipeline cache data" << std::endl;
+                return;
+            }
+
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+            PipelineCacheFileHeader header{};
+            header.magic = PIPELINE_CACHE_MAGIC;
+            header.dataSize = static_cast<uint32_t>(dataSize);
+            header.vendorID = properties.vendorID;
+            header.deviceID = properties.deviceID;
+            header.driverVersion = properties.driverVersion;
+            memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+            std::string tempPath = PIPELINE_CACHE_PATH + ".tmp";
+            {
+                std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+                file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                file.write(data.data(), dataSize);
+                if (!file) {
+                    std::cerr << "failed to write pipeline cache file" << std::endl;
+                    return;
+                }
+            }
+
+            std::error_code error;
+            std::filesystem::rename(tempPath, PIPELINE_CACHE_PATH, error);
+            if (error) {
+                std::cerr << "failed to replace pipeline cache file: " << error.message() << std::endl;
+                std::filesystem::remove(tempPath, error);
+            }
         }
 
         //create framebuffer for each image in the swapchain
         void createFramebuffers() {
+            CPU_PROFILE_FUNCTION();
+
             swapChainFramebuffers.resize(swapChainImageViews.size());
 
             for (size_t i = 0; i < swapChainImageViews.size(); i++) {
@@ -827,13 +4650,15 @@ class HelloTriangleApplication {
             }
         }
 
-        //create CommandPool
+        //create CommandPool used for short-lived upload command buffers
         void createCommandPool() {
+            CPU_PROFILE_FUNCTION();
+
             QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
 
             VkCommandPoolCreateInfo poolInfo{};
             poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-            poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
             poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
 
             if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
@@ -843,6 +4668,8 @@ class HelloTriangleApplication {
 
         //create depth image
         void createDepthResources() {
+            CPU_PROFILE_FUNCTION();
+
             VkFormat depthFormat = findDepthFormat();
 
             createImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
@@ -879,15 +4706,25 @@ class HelloTriangleApplication {
             return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
         }
 
-        //create texture image
-        void createTextureImage() {
-            int texWidth, texHeight, texChannels;
-            stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-            VkDeviceSize imageSize = texWidth * texHeight * 4;
+        //decode the texture file into texturePixels, CPU only so it can run before the device exists
+        void decodeTexture() {
+            CPU_PROFILE_FUNCTION();
 
-            if (!pixels) {
+            int texChannels;
+            texturePixels = stbi_load(TEXTURE_PATH.c_str(), &textureWidth, &textureHeight, &texChannels, STBI_rgb_alpha);
+
+            if (!texturePixels) {
                 throw std::runtime_error("failed to load texture image!");
             }
+        }
+
+        //create texture image from the decoded pixels
+        void createTextureImage() {
+            CPU_PROFILE_FUNCTION();
+
+            int texWidth = textureWidth, texHeight = textureHeight;
+            stbi_uc* pixels = texturePixels;
+            VkDeviceSize imageSize = texWidth * texHeight * 4;
 
             VkBuffer stagingBuffer;
             VkDeviceMemory stagingBufferMemory;
@@ -899,6 +4736,7 @@ class HelloTriangleApplication {
             vkUnmapMemory(device, stagingBufferMemory);
 
             stbi_image_free(pixels);
+            texturePixels = nullptr;
 
             createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
 
@@ -906,17 +4744,20 @@ class HelloTriangleApplication {
                 copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
             transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-            vkDestroyBuffer(device, stagingBuffer, nullptr);
-            vkFreeMemory(device, stagingBufferMemory, nullptr);
+            destroyStagingBuffer(stagingBuffer, stagingBufferMemory);
         }
 
         //create imageview of texture
         void createTextureImageView() {
+            CPU_PROFILE_FUNCTION();
+
                 textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
         }
 
         //create sampler that will be used for the texture
         void createTextureSampler() {
+            CPU_PROFILE_FUNCTION();
+
             VkPhysicalDeviceProperties properties{};
             vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
@@ -1071,6 +4912,8 @@ class HelloTriangleApplication {
 
         //load model .obj file into vertex and indices containers
         void loadModel() {
+            CPU_PROFILE_FUNCTION();
+
             tinyobj::attrib_t attrib;
             std::vector<tinyobj::shape_t> shapes;
             std::vector<tinyobj::material_t> materials;
@@ -1109,9 +4952,34 @@ class HelloTriangleApplication {
             }
         }
 
+        //split the model into settings.drawCount draws of whole triangles, ranges wrap around when there are more draws than triangles
+        void buildDrawList() {
+            CPU_PROFILE_FUNCTION();
+
+            uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+            uint32_t drawCount = settings.drawCount;
+            uint32_t trianglesPerDraw = std::max(1u, triangleCount / drawCount);
+
+            drawList.clear();
+            drawList.reserve(drawCount);
+
+            for (uint32_t i = 0; i < drawCount; i++) {
+                uint32_t firstTriangle = (i * trianglesPerDraw) % triangleCount;
+                uint32_t count = std::min(trianglesPerDraw, triangleCount - firstTriangle);
+
+                //the last draw picks up the remainder when the split is exact
+                if (drawCount <= triangleCount && i == drawCount - 1) {
+                    count = triangleCount - firstTriangle;
+                }
+
+                drawList.push_back({count * 3, firstTriangle * 3});
+            }
+        }
 
         //create vertex buffer
         void createVertexBuffer() {
+            CPU_PROFILE_FUNCTION();
+
             VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
 
             VkBuffer stagingBuffer;
@@ -1127,12 +4995,13 @@ class HelloTriangleApplication {
 
             copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
 
-            vkDestroyBuffer(device, stagingBuffer, nullptr);
-            vkFreeMemory(device, stagingBufferMemory, nullptr);
+            destroyStagingBuffer(stagingBuffer, stagingBufferMemory);
         }
 
         //create index buffer
         void createIndexBuffer() {
+            CPU_PROFILE_FUNCTION();
+
             VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
 
             VkBuffer stagingBuffer;
@@ -1148,91 +5017,129 @@ class HelloTriangleApplication {
 
             copyBuffer(stagingBuffer, indexBuffer, bufferSize);
 
-            vkDestroyBuffer(device, stagingBuffer, nullptr);
-            vkFreeMemory(device, stagingBufferMemory, nullptr);
+            destroyStagingBuffer(stagingBuffer, stagingBufferMemory);
         }
 
         //create uniform buffer
         void createUniformBuffers() {
+            CPU_PROFILE_FUNCTION();
+
             VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
-            uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-            uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-            uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+            uniformBuffers.resize(settings.framesInFlight);
+            uniformBuffersMemory.resize(settings.framesInFlight);
+            uniformBuffersMapped.resize(settings.framesInFlight);
+            uniformBufferStates.assign(settings.framesInFlight, UniformBufferState{});
 
-            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            for (size_t i = 0; i < settings.framesInFlight; i++) {
                 createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
                 
                 vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]);
             }
+
+            createObjectRing();
         }
 
-        //create descriptor pool
-        void createDescriptorPool() {
-            std::array<VkDescriptorPoolSize, 2> poolSizes{};
-            poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-            poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        //one persistently mapped buffer holding every draw's ObjectData, split into a region per frame in flight
+        void createObjectRing() {
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+            VkDeviceSize alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+            VkDeviceSize stride = (sizeof(ObjectData) + alignment - 1) & ~(alignment - 1);
 
-            VkDescriptorPoolCreateInfo poolInfo{};
-            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-            poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-            poolInfo.pPoolSizes = poolSizes.data();
-            poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+            //frame regions start at aligned offsets too
+            objectRingCapacity = std::max<size_t>(drawList.size(), 1);
+            VkDeviceSize frameSize = stride * objectRingCapacity;
+            VkDeviceSize bufferSize = frameSize * settings.framesInFlight;
 
-            if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create descriptor pool!");
+            createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, objectRingBuffer, objectRingMemory);
+
+            void* mapped;
+            vkMapMemory(device, objectRingMemory, 0, bufferSize, 0, &mapped);
+            objectRing.create(mapped, frameSize, alignment);
+        }
+
+        //descriptors needed by one set 0, taken from the reflected bindings
+        std::vector<VkDescriptorPoolSize> descriptorSetSizes() {
+            std::vector<VkDescriptorPoolSize> setSizes;
+            for (auto& binding : shaderInterface.sets[0]) {
+                auto setSize = std::find_if(setSizes.begin(), setSizes.end(), [&](const VkDescriptorPoolSize& size) { return size.type == binding.descriptorType; });
+                if (setSize == setSizes.end()) {
+                    setSizes.push_back({binding.descriptorType, 0});
+                    setSize = setSizes.end() - 1;
+                }
+                setSize->descriptorCount += binding.descriptorCount;
             }
+            return setSizes;
         }
 
-        //create descriptor sets
-        void createDescriptorSets() {
-            std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
-            VkDescriptorSetAllocateInfo allocInfo{};
-            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-            allocInfo.descriptorPool = descriptorPool;
-            allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-            allocInfo.pSetLayouts = layouts.data();
+        //create the descriptor allocators, their pools are sized from the reflected set 0 bindings
+        void createDescriptorAllocators() {
+            CPU_PROFILE_FUNCTION();
 
-            descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-            if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
-                throw std::runtime_error("failed to allocate descriptor sets!");
-            }
+            std::vector<VkDescriptorPoolSize> setSizes = descriptorSetSizes();
+            descriptorAllocator.create(device, setSizes, settings.framesInFlight);
 
-            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-                VkDescriptorBufferInfo bufferInfo{};
-                bufferInfo.buffer = uniformBuffers[i];
-                bufferInfo.offset = 0;
-                bufferInfo.range = sizeof(UniformBufferObject);
+            frameDescriptorAllocators.resize(settings.framesInFlight);
+            for (auto& allocator : frameDescriptorAllocators) {
+                allocator.create(device, setSizes, 4);
+            }
+        }
 
-                VkDescriptorImageInfo imageInfo{};
-                imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-                imageInfo.imageView = textureImageView;
-                imageInfo.sampler = textureSampler;
+        //create the long lived descriptor sets cached command buffers bind, frames recorded every time allocate theirs in beginFrameDescriptors
+        void createDescriptorSets() {
+            CPU_PROFILE_FUNCTION();
 
-                std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+            if (!settings.cacheCommandBuffers) {
+                return;
+            }
 
-                descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                descriptorWrites[0].dstSet = descriptorSets[i];
-                descriptorWrites[0].dstBinding = 0;
-                descriptorWrites[0].dstArrayElement = 0;
-                descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-                descriptorWrites[0].descriptorCount = 1;
-                descriptorWrites[0].pBufferInfo = &bufferInfo;
+            descriptorSets.resize(settings.framesInFlight);
 
-                descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                descriptorWrites[1].dstSet = descriptorSets[i];
-                descriptorWrites[1].dstBinding = 1;
-                descriptorWrites[1].dstArrayElement = 0;
-                descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-                descriptorWrites[1].descriptorCount = 1;
-                descriptorWrites[1].pImageInfo = &imageInfo;
+            for (size_t i = 0; i < settings.framesInFlight; i++) {
+                descriptorSets[i] = descriptorAllocator.allocate(descriptorSetLayout);
+                descriptorAllocator.write(descriptorSets[i], frameDescriptorWrites(i));
+            }
+        }
 
-                vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        //recycle the frame slot's descriptor sets, its fence has signaled, and pick the set the frame binds: a fresh one from the
+        //slot's allocator, or the long lived one when the recorded commands are reused
+        void beginFrameDescriptors() {
+            DescriptorAllocator& allocator = frameDescriptorAllocators[currentFrame];
+            allocator.reset();
+            if (settings.cacheCommandBuffers) {
+                frameDescriptorSet = descriptorSets[currentFrame];
+            } else {
+                frameDescriptorSet = allocator.allocateCached(descriptorSetLayout, frameDescriptorWrites(currentFrame));
             }
         }
 
+        //contents of set 0 for a frame in flight
+        std::vector<DescriptorWrite> frameDescriptorWrites(size_t frame) {
+            DescriptorWrite uboWrite{};
+            uboWrite.binding = 0;
+            uboWrite.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            uboWrite.bufferInfo.buffer = uniformBuffers[frame];
+            uboWrite.bufferInfo.offset = 0;
+            uboWrite.bufferInfo.range = sizeof(UniformBufferObject);
+
+            DescriptorWrite samplerWrite{};
+            samplerWrite.binding = 1;
+            samplerWrite.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            samplerWrite.imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            samplerWrite.imageInfo.imageView = textureImageView;
+            samplerWrite.imageInfo.sampler = textureSampler;
+
+            DescriptorWrite objectWrite{};
+            objectWrite.binding = OBJECT_DATA_BINDING;
+            objectWrite.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            objectWrite.bufferInfo.buffer = objectRingBuffer;
+            objectWrite.bufferInfo.offset = 0;
+            objectWrite.bufferInfo.range = sizeof(ObjectData);
+
+            return {uboWrite, samplerWrite, objectWrite};
+        }
+
         //general function for creating buffers
         void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
             VkBufferCreateInfo bufferInfo{};
@@ -1262,6 +5169,10 @@ class HelloTriangleApplication {
 
         //helper function to start command recording to command buffer
         VkCommandBuffer beginSingleTimeCommands() {
+            if (uploadCommandBuffer != VK_NULL_HANDLE) {
+                return uploadCommandBuffer;
+            }
+
             VkCommandBufferAllocateInfo allocInfo{};
             allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
             allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
@@ -1283,6 +5194,9 @@ class HelloTriangleApplication {
         
         //helper function to submit and free command buffer
         void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+            if (commandBuffer == uploadCommandBuffer) {
+                return;                     //recorded into the batch, submitUploadBatch submits it
+            }
 
             vkEndCommandBuffer(commandBuffer);
 
@@ -1297,6 +5211,37 @@ class HelloTriangleApplication {
             vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
         }
 
+        //record every following single time command into one command buffer, so the init uploads share one submit and wait
+        void beginUploadBatch() {
+            uploadCommandBuffer = VK_NULL_HANDLE;
+            uploadCommandBuffer = beginSingleTimeCommands();
+        }
+
+        //submit the batched uploads, wait for them and destroy their staging buffers
+        void submitUploadBatch() {
+            CPU_PROFILE_FUNCTION();
+
+            VkCommandBuffer commandBuffer = uploadCommandBuffer;
+            uploadCommandBuffer = VK_NULL_HANDLE;
+            endSingleTimeCommands(commandBuffer);
+
+            for (auto& [buffer, memory] : uploadStagingBuffers) {
+                vkDestroyBuffer(device, buffer, nullptr);
+                vkFreeMemory(device, memory, nullptr);
+            }
+            uploadStagingBuffers.clear();
+        }
+
+        //staging buffers recorded into the upload batch are still in use until submitUploadBatch has waited for it
+        void destroyStagingBuffer(VkBuffer buffer, VkDeviceMemory memory) {
+            if (uploadCommandBuffer != VK_NULL_HANDLE) {
+                uploadStagingBuffers.push_back({buffer, memory});
+                return;
+            }
+            vkDestroyBuffer(device, buffer, nullptr);
+            vkFreeMemory(device, memory, nullptr);
+        }
+
         //copy contents of one buffer into another
         void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
             VkCommandBuffer commandBuffer = beginSingleTimeCommands();
@@ -1324,25 +5269,225 @@ class HelloTriangleApplication {
             throw std::runtime_error("failed to find suitable memory type!");
         }
 
-        //create command buffer
-        void createCommandBuffers() {
-            commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        //create a command pool for every frame in flight, plus one per recording worker when recording in parallel
+        void createFrameCommandPools() {
+            CPU_PROFILE_FUNCTION();
 
-            VkCommandBufferAllocateInfo allocInfo{};
-            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocInfo.commandPool = commandPool;
-            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+            QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+            frameCommandPools.resize(settings.framesInFlight);
+            for (auto& pool : frameCommandPools) {
+                pool.create(device, queueFamilyIndices.graphicsFamily.value());
+            }
+
+            if (settings.cacheCommandBuffers) {
+                //cached buffers are recorded over individually when the model moves
+                VkCommandPoolCreateInfo poolInfo{};
+                poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+                poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+                if (vkCreateCommandPool(device, &poolInfo, nullptr, &cachedCommandPool) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create command pool!");
+                }
+            }
+
+            if (settings.recordThreads == 0) {
+                return;
+            }
+
+            recordCommandPools.resize(settings.framesInFlight, std::vector<FrameCommandPool>(settings.recordThreads));
+            for (auto& framePools : recordCommandPools) {
+                for (auto& pool : framePools) {
+                    pool.create(device, queueFamilyIndices.graphicsFamily.value());
+                }
+            }
+        }
+
+        //recycle every command buffer recorded for the current frame slot, its fence must have signaled
+        void resetFrameCommandPools() {
+            frameCommandPools[currentFrame].reset();
+
+            if (settings.recordThreads > 0) {
+                for (auto& pool : recordCommandPools[currentFrame]) {
+                    pool.reset();
+                }
+            }
+        }
+
+        //record state setup and the draws in drawList[firstDraw, lastDraw) into a command buffer inside the render pass
+        void recordDraws(VkCommandBuffer commandBuffer, size_t firstDraw, size_t lastDraw) {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, boundPipeline);
+
+            VkViewport viewport{};
+            viewport.x = 0.0f;
+            viewport.y = 0.0f;
+            viewport.width = (float) swapChainExtent.width;
+            viewport.height = (float) swapChainExtent.height;
+            viewport.minDepth = 0.0f;
+            viewport.maxDepth = 1.0f;
+            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+            VkRect2D scissor{};
+            scissor.offset = {0, 0};
+            scissor.extent = swapChainExtent;
+            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+            VkBuffer vertexBuffers[] = {vertexBuffer};
+            VkDeviceSize offsets[] = {0};
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+            vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+            if (boundObjectDataInRing) {
+                //one set for every draw, only the dynamic offset of the object data changes
+                ObjectData objectData{};
+                objectData.model = modelMatrix;
+
+                for (size_t i = firstDraw; i < lastDraw; i++) {
+                    uint32_t objectOffset = objectRing.push(&objectData, sizeof(objectData));
+                    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &frameDescriptorSet, 1, &objectOffset);
+                    vkCmdDrawIndexed(commandBuffer, drawList[i].indexCount, 1, drawList[i].firstIndex, 0, 0);
+                }
+                return;
+            }
+
+            uint32_t objectOffset = 0;
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &frameDescriptorSet, 1, &objectOffset);
+
+            PushConstants pushConstants{};
+            pushConstants.model = modelMatrix;
+
+            for (size_t i = firstDraw; i < lastDraw; i++) {
+                vkCmdPushConstants(commandBuffer, pipelineLayout, shaderInterface.pushConstantRanges[0].stageFlags, 0, sizeof(PushConstants), &pushConstants);
+                vkCmdDrawIndexed(commandBuffer, drawList[i].indexCount, 1, drawList[i].firstIndex, 0, 0);
+            }
+        }
+
+        //record one part of the draw list into a secondary command buffer from that part's pool, parts run as separate jobs
+        VkCommandBuffer recordSecondaryCommandBuffer(uint32_t part, uint32_t partCount, uint32_t imageIndex) {
+            CPU_PROFILE_FUNCTION();
+
+            VkCommandBuffer commandBuffer = recordCommandPools[currentFrame][part].allocate(VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+            VkCommandBufferInheritanceInfo inheritanceInfo{};
+            inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritanceInfo.renderPass = renderPass;
+            inheritanceInfo.subpass = 0;
+            inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
+            if (pipelineStatistics.enabled() && pipelineStatisticsActive) {
+                pipelineStatistics.inherit(inheritanceInfo);
+            }
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+            if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording secondary command buffer!");
+            }
+
+            size_t firstDraw = drawList.size() * part / partCount;
+            size_t lastDraw = drawList.size() * (part + 1) / partCount;
+            recordDraws(commandBuffer, firstDraw, lastDraw);
+
+            if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record secondary command buffer!");
+            }
+
+            return commandBuffer;
+        }
+
+        //command buffer for the current frame slot and swap chain image, recorded on first use and reused until invalidateCommandCache
+        VkCommandBuffer getCachedCommandBuffer(uint32_t imageIndex) {
+            if (cachedCommandBuffers.empty()) {
+                cachedCommandBuffers.resize(settings.framesInFlight, std::vector<CachedCommandBuffer>(swapChainImages.size()));
+            }
+
+            CachedCommandBuffer& cached = cachedCommandBuffers[currentFrame][imageIndex];
+            VkCommandBuffer& commandBuffer = cached.commandBuffer;
+            if (commandBuffer == VK_NULL_HANDLE) {
+                VkCommandBufferAllocateInfo allocInfo{};
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.commandPool = cachedCommandPool;
+                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+                allocInfo.commandBufferCount = 1;
+
+                if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to allocate command buffers!");
+                }
+
+                recordCommandBuffer(commandBuffer, imageIndex, true);
+                cached.model = modelMatrix;
+            } else if (cached.model != modelMatrix) {
+                //the buffer was last submitted from this frame slot, whose fence has signaled, so it can be recorded over
+                recordCommandBuffer(commandBuffer, imageIndex, true);
+                cached.model = modelMatrix;
+                cachedModelRerecords++;
+            }
+
+            return commandBuffer;
+        }
+
+        //drop every cached command buffer, called whenever swap chain, pipeline or draw list change
+        void invalidateCommandCache() {
+            std::vector<VkCommandBuffer> retired;
+            for (auto& frameBuffers : cachedCommandBuffers) {
+                for (auto& cached : frameBuffers) {
+                    if (cached.commandBuffer != VK_NULL_HANDLE) {
+                        retired.push_back(cached.commandBuffer);
+                    }
+                }
+            }
+            cachedCommandBuffers.clear();
+
+            //recent frames may still be executing them
+            if (!retired.empty()) {
+                deletionQueue.push(frameNumber, 0, [this, retired]() {
+                    vkFreeCommandBuffers(device, cachedCommandPool, static_cast<uint32_t>(retired.size()), retired.data());
+                });
+            }
+        }
+
+        //pipeline variant picked with the P key, specialised for the current quality tier
+        PipelineKey activePipelineKey() {
+            PipelineKey key = pipelineVariants[activePipelineVariant];
+            //a branching pipeline serves every tier, so the tier bits are left out of its key
+            key.shaderFeatures = dynamicShaderFeatures ? SHADER_FEATURE_DYNAMIC : shaderFeatures;
+            if (settings.objectDataInRing) {
+                key.shaderFeatures |= SHADER_FEATURE_OBJECT_BUFFER;
+            }
+            return key;
+        }
+
+        //bind the selected pipeline variant once it has compiled, until then keep drawing with the default pipeline
+        void selectPipeline() {
+            PipelineKey key = activePipelineKey();
+            VkPipeline pipeline = pipelineRegistry.request(key);
+            if (pipeline == VK_NULL_HANDLE) {
+                pipeline = graphicsPipeline;
+                key = defaultPipelineKey;
+                redrawRequested = true;     //draw again once the requested pipeline has compiled
+            }
+            boundObjectDataInRing = (key.shaderFeatures & SHADER_FEATURE_OBJECT_BUFFER) != 0;
 
-            if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-                throw std::runtime_error("failed to allocate command buffers!");
+            //cached command buffers have the old pipeline baked in
+            if (pipeline != boundPipeline && boundPipeline != VK_NULL_HANDLE) {
+                invalidateCommandCache();
             }
+            boundPipeline = pipeline;
         }
 
-        //record command buffer
-        void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+        //record command buffer, reusable buffers are recorded inline since worker secondaries are recycled every frame
+        void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool reusable = false) {
+            CPU_PROFILE_FUNCTION();
+
+            auto recordStart = std::chrono::high_resolution_clock::now();
+
             VkCommandBufferBeginInfo beginInfo{};
             beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = reusable ? 0 : VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
             if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
                 throw std::runtime_error("failed to begin recording command buffer!");
@@ -1362,46 +5507,125 @@ class HelloTriangleApplication {
             renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
             renderPassInfo.pClearValues = clearValues.data();
 
-            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            //"frame" covers the whole command buffer, passes added later get scopes of their own inside it
+            gpuProfiler.beginCommandBuffer(commandBuffer, currentFrame);
+            uint32_t frameScope = gpuProfiler.beginScope(commandBuffer, currentFrame, "frame");
+
+            bool queryStatistics = pipelineStatistics.enabled() && pipelineStatisticsActive;
+            if (queryStatistics) {
+                pipelineStatistics.begin(commandBuffer, currentFrame);
+            }
+
+            {
+                GpuScope renderPassScope(gpuProfiler, commandBuffer, currentFrame, "render pass");
 
-                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+                if (settings.recordThreads > 0 && !reusable) {
+                    //jobs record their share of the draw list into secondary command buffers that the primary executes
+                    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-                VkViewport viewport{};
-                viewport.x = 0.0f;
-                viewport.y = 0.0f;
-                viewport.width = (float) swapChainExtent.width;
-                viewport.height = (float) swapChainExtent.height;
-                viewport.minDepth = 0.0f;
-                viewport.maxDepth = 1.0f;
-                vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+                        std::vector<VkCommandBuffer> secondaries(settings.recordThreads);
+                        jobSystem->parallelFor(settings.recordThreads, 1, [&](uint32_t first, uint32_t last) {
+                            for (uint32_t i = first; i < last; i++) {
+                                secondaries[i] = recordSecondaryCommandBuffer(i, settings.recordThreads, imageIndex);
+                            }
+                        });
 
-                VkRect2D scissor{};
-                scissor.offset = {0, 0};
-                scissor.extent = swapChainExtent;
-                vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+                        vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
 
-                VkBuffer vertexBuffers[] = {vertexBuffer};
-                VkDeviceSize offsets[] = {0};
-                vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);            
+                    vkCmdEndRenderPass(commandBuffer);
+                } else {
+                    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-                vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+                        recordDraws(commandBuffer, 0, drawList.size());
 
-                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+                    vkCmdEndRenderPass(commandBuffer);
+                }
+            }
 
-                vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+            if (queryStatistics) {
+                pipelineStatistics.end(commandBuffer, currentFrame);
+            }
 
-            vkCmdEndRenderPass(commandBuffer);
+            gpuProfiler.endScope(commandBuffer, currentFrame, frameScope);
 
             if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
                 throw std::runtime_error("failed to record command buffer!");
             }
+
+            auto recordEnd = std::chrono::high_resolution_clock::now();
+            recordTimings.add(std::chrono::duration<double, std::milli>(recordEnd - recordStart).count());
+        }
+
+        //create the GPU profiler's query pools, it stays disabled if the graphics queue cannot write timestamps
+        void createGpuProfiler() {
+            CPU_PROFILE_FUNCTION();
+
+            gpuProfiler.create(device, physicalDevice, findQueueFamilies(physicalDevice).graphicsFamily.value(), settings.framesInFlight);
+        }
+
+        //read back the GPU scopes of the frame that last used this slot, its fence has signaled so the results are available
+        void readGpuProfile() {
+            for (const auto& [scope, milliseconds] : gpuProfiler.collect(currentFrame)) {
+                if (strcmp(scope, "frame") == 0) {
+                    gpuFrameTimings.add(milliseconds);
+                    if (measuringBenchmark) {
+                        benchmarkGpuFrame.add(milliseconds);
+                    }
+                }
+            }
+        }
+
+        //create the statistics and occlusion query pools when --pipeline-stats is on and the device supports them
+        void createPipelineStatistics() {
+            if (settings.pipelineStatistics) {
+                VkPhysicalDeviceFeatures supportedFeatures;
+                vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+                pipelineStatistics.create(device, settings.framesInFlight, supportedFeatures.occlusionQueryPrecise);
+            }
+        }
+
+        //read back the counters of the frame that last used this slot
+        void readPipelineStatistics() {
+            if (auto counters = pipelineStatistics.collect(currentFrame)) {
+                for (size_t i = 0; i < counters->size(); i++) {
+                    pipelineCounterStats[i].add(static_cast<double>((*counters)[i]));
+                }
+            }
+        }
+
+        //average, min and max of every counter per frame, with the query overhead if it was measured
+        void writePipelineStatisticsReport() {
+            std::ofstream file(settings.pipelineStatisticsPath);
+            file << "{" << std::endl;
+            file << "  \"frames\": " << pipelineCounterStats[0].count << "," << std::endl;
+            file << "  \"draws\": " << drawList.size() << "," << std::endl;
+            file << "  \"indices\": " << indices.size() << "," << std::endl;
+            file << "  \"counters_per_frame\": {" << std::endl;
+            for (size_t i = 0; i < PIPELINE_COUNTER_NAMES.size(); i++) {
+                const TimingStats& counter = pipelineCounterStats[i];
+                file << "    \"" << PIPELINE_COUNTER_NAMES[i] << "\": {\"avg\": " << counter.average() << ", \"min\": " << counter.min << ", \"max\": " << counter.max
+                     << "}" << (i + 1 < PIPELINE_COUNTER_NAMES.size() ? "," : "") << std::endl;
+            }
+            file << "  }";
+            if (!pipelineStatisticsOverhead.empty()) {
+                file << "," << std::endl << "  \"overhead\": " << pipelineStatisticsOverhead;
+            }
+            file << std::endl << "}" << std::endl;
+
+            if (!file) {
+                throw std::runtime_error("failed to write " + settings.pipelineStatisticsPath + "!");
+            }
         }
 
         //Create syncronization objects
         void createSyncObjects() {
-            imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-            renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-            inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+            CPU_PROFILE_FUNCTION();
+
+            imageAvailableSemaphores.resize(settings.framesInFlight);
+            renderFinishedSemaphores.resize(settings.framesInFlight);
+            inFlightFences.resize(settings.framesInFlight);
+            frameNumberInFlight.resize(settings.framesInFlight, 0);
+            frameSubmitLatency.resize(settings.framesInFlight);
 
             VkSemaphoreCreateInfo semaphoreInfo{};
             semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -1410,7 +5634,7 @@ class HelloTriangleApplication {
             fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
             fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            for (size_t i = 0; i < settings.framesInFlight; i++) {
                 if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
                     vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
                     vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
@@ -1421,26 +5645,140 @@ class HelloTriangleApplication {
 
         //update uniform buffer
         void updateUniformBuffer(uint32_t currentImage) {
-            static auto startTime = std::chrono::high_resolution_clock::now();
+            CPU_PROFILE_FUNCTION();
 
+            //benchmarks animate on a fixed clock so every run renders the same frames, otherwise the clock only runs while animating
             auto currentTime = std::chrono::high_resolution_clock::now();
-            float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+            if (animating) {
+                animationTime += std::chrono::duration<float, std::chrono::seconds::period>(currentTime - lastAnimationUpdate).count();
+            }
+            lastAnimationUpdate = currentTime;
+            float time = settings.benchmark ? frameNumber * BENCHMARK_TIMESTEP : animationTime;
+
+            //cached command buffers have the push constants baked in and are recorded again when this changes, so both modes
+            //render the same frames and cpu frame times compare the same work
+            modelMatrix = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+
+            //view and projection only change on input or resize, each frame in flight's buffer is brought up to date with the ranges that are stale
+            camera.setAspect(swapChainExtent.width / (float) swapChainExtent.height);
+            camera.update();
+
+            UniformBufferState& state = uniformBufferStates[currentImage];
+            char* mapped = static_cast<char*>(uniformBuffersMapped[currentImage]);
+            size_t bytesWritten = 0;
+            auto write = [&](size_t offset, const void* data, size_t size) {
+                memcpy(mapped + offset, data, size);
+                bytesWritten += size;
+            };
+
+            bool viewStale = state.viewVersion != camera.viewVersion;
+            bool projStale = state.projVersion != camera.projVersion;
+            if (viewStale) {
+                write(offsetof(UniformBufferObject, view), &camera.view(), sizeof(glm::mat4));
+            }
+            if (projStale) {
+                write(offsetof(UniformBufferObject, proj), &camera.proj(), sizeof(glm::mat4));
+            }
+            if (viewStale || projStale) {
+                write(offsetof(UniformBufferObject, viewProj), &camera.viewProj(), sizeof(glm::mat4));
+            }
+            if (state.featureFlags != shaderFeatures) {
+                write(offsetof(UniformBufferObject, featureFlags), &shaderFeatures, sizeof(uint32_t));
+            }
+            state = UniformBufferState{camera.viewVersion, camera.projVersion, shaderFeatures};
+
+            auto updateEnd = std::chrono::high_resolution_clock::now();
+            uniformUpdateTimings.add(std::chrono::duration<double, std::micro>(updateEnd - currentTime).count());
+            uniformBytesWritten.add(static_cast<double>(bytesWritten));
+        }
+
+        //what latencyTimings measures on this device
+        const char* latencyMetric() const {
+            return getPastPresentationTiming != nullptr ? "input sample to present" : "submit to GPU completion";
+        }
+
+        void addLatency(const LatencySample& sample, std::chrono::steady_clock::time_point end) {
+            double latency = std::chrono::duration<double, std::milli>(end - sample.start).count();
+            latencyTimings.add(latency);
+            presentModeLatencies[sample.presentMode].add(latency);
+        }
 
-            UniformBufferObject ubo{};
-            ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-            ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-            ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float) swapChainExtent.height, 0.1f, 10.0f);
-            ubo.proj[1][1] *= -1;
+        //record the latency of frames that finished since the last call, waiting for outstanding fences if wait is set
+        void collectLatency(bool wait) {
+            if (getPastPresentationTiming != nullptr) {
+                //actualPresentTime is CLOCK_MONOTONIC nanoseconds, the clock steady_clock reads on Linux
+                uint32_t count = 0;
+                getPastPresentationTiming(device, swapChain, &count, nullptr);
+                std::vector<VkPastPresentationTimingGOOGLE> timings(count);
+                getPastPresentationTiming(device, swapChain, &count, timings.data());
+
+                for (const auto& timing : timings) {
+                    //presents without a timing were dropped or replaced before reaching the display
+                    while (!pendingPresents.empty() && pendingPresents.front().presentID < timing.presentID) {
+                        pendingPresents.pop_front();
+                    }
+                    if (pendingPresents.empty() || pendingPresents.front().presentID != timing.presentID) {
+                        continue;
+                    }
+                    std::chrono::steady_clock::time_point presented{std::chrono::nanoseconds(timing.actualPresentTime)};
+                    if (presented >= pendingPresents.front().start) {
+                        addLatency(pendingPresents.front(), presented);
+                    }
+                    pendingPresents.pop_front();
+                }
+                return;
+            }
 
-            memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+            //the fences are only polled, so a sample is late by at most the time to the next poll
+            for (uint32_t i = 0; i < frameSubmitLatency.size(); i++) {
+                if (!frameSubmitLatency[i]) {
+                    continue;
+                }
+                if (wait) {
+                    vkWaitForFences(device, 1, &inFlightFences[i], VK_TRUE, UINT64_MAX);
+                } else if (vkGetFenceStatus(device, inFlightFences[i]) != VK_SUCCESS) {
+                    continue;
+                }
+                addLatency(*frameSubmitLatency[i], std::chrono::steady_clock::now());
+                frameSubmitLatency[i].reset();
+            }
         }
 
         //draw frame
         void drawFrame() {
-            vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+            CPU_PROFILE_FUNCTION();
+
+            collectLatency(false);
+
+            double fenceWait;
+            {
+                CPU_PROFILE_SCOPE("fence wait");
+                auto fenceWaitStart = std::chrono::high_resolution_clock::now();
+                vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+                fenceWait = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - fenceWaitStart).count();
+            }
+
+            //a frame still pending before the wait completed as the wait returned
+            collectLatency(false);
 
+            //fences also cover every earlier submission, so all frames up to the one in this slot are done
+            completedFrameNumber = std::max(completedFrameNumber, frameNumberInFlight[currentFrame]);
+            deletionQueue.flush(completedFrameNumber);
+            resetFrameCommandPools();
+            beginFrameDescriptors();
+            objectRing.beginFrame(currentFrame);
+            readGpuProfile();
+            readPipelineStatistics();
+
+            //headless images are written in turn, the render pass dependency orders them after earlier frames like the shared depth image
             uint32_t imageIndex;
-            VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+            VkResult result = VK_SUCCESS;
+            if (settings.headless) {
+                imageIndex = static_cast<uint32_t>(frameNumber % swapChainImages.size());
+            } else {
+                CPU_PROFILE_SCOPE("acquire");
+                result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+            }
 
             if (result == VK_ERROR_OUT_OF_DATE_KHR) {
                 recreateSwapChain();
@@ -1448,65 +5786,127 @@ class HelloTriangleApplication {
             } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
                 throw std::runtime_error("failed to acquire swap chain image!");
             }
+            lastImageIndex = imageIndex;
+
+            auto frameStart = std::chrono::high_resolution_clock::now();
 
             updateUniformBuffer(currentFrame);
 
             vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
-            vkResetCommandBuffer(commandBuffers[currentFrame], /*VkCommandBufferResetFlagBits*/ 0);
-            recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+            applyShaderReload();
+            selectPipeline();
+
+            VkCommandBuffer commandBuffer;
+            {
+                CPU_PROFILE_SCOPE("record");
+                if (settings.cacheCommandBuffers) {
+                    commandBuffer = getCachedCommandBuffer(imageIndex);
+                } else {
+                    commandBuffer = frameCommandPools[currentFrame].allocate(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+                    recordCommandBuffer(commandBuffer, imageIndex);
+                }
+            }
 
             VkSubmitInfo submitInfo{};
             submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
+            //nothing is acquired or presented headless, so there are no semaphores to wait on or signal
             VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
             VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-            submitInfo.waitSemaphoreCount = 1;
+            submitInfo.waitSemaphoreCount = settings.headless ? 0 : 1;
             submitInfo.pWaitSemaphores = waitSemaphores;
             submitInfo.pWaitDstStageMask = waitStages;
 
             submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+            submitInfo.pCommandBuffers = &commandBuffer;
 
             VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.signalSemaphoreCount = settings.headless ? 0 : 1;
             submitInfo.pSignalSemaphores = signalSemaphores;
 
-            if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to submit draw command buffer!");
+            {
+                CPU_PROFILE_SCOPE("submit");
+                if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to submit draw command buffer!");
+                }
+            }
+
+            frameNumber++;
+            frameNumberInFlight[currentFrame] = frameNumber;
+            if (frameNumber == 1) {
+                double firstFrameTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - runStart).count();
+                std::cout << "time to first frame: " << firstFrameTime << " ms (initVulkan " << initTime << " ms)" << std::endl;
+            }
+            gpuProfiler.submitted(currentFrame);
+            if (pipelineStatistics.enabled() && pipelineStatisticsActive) {
+                pipelineStatistics.submitted(currentFrame);
+            }
+            if (getPastPresentationTiming == nullptr) {
+                frameSubmitLatency[currentFrame] = LatencySample{static_cast<uint32_t>(frameNumber), std::chrono::steady_clock::now(), swapChainPresentMode};
             }
 
-            VkPresentInfoKHR presentInfo{};
-            presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+            if (!settings.headless) {
+                CPU_PROFILE_SCOPE("present");
+
+                VkPresentInfoKHR presentInfo{};
+                presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+
+                //an ID to match the present with its timing later, no target time so presentation is unchanged
+                VkPresentTimeGOOGLE presentTime{static_cast<uint32_t>(frameNumber), 0};
+                VkPresentTimesInfoGOOGLE presentTimesInfo{};
+                presentTimesInfo.sType = VK_STRUCTURE_TYPE_PRESENT_TIMES_INFO_GOOGLE;
+                presentTimesInfo.swapchainCount = 1;
+                presentTimesInfo.pTimes = &presentTime;
+                if (getPastPresentationTiming != nullptr) {
+                    presentInfo.pNext = &presentTimesInfo;
+                    pendingPresents.push_back(LatencySample{presentTime.presentID, lastInputTime, swapChainPresentMode});
+                }
 
-            presentInfo.waitSemaphoreCount = 1;
-            presentInfo.pWaitSemaphores = signalSemaphores;
+                presentInfo.waitSemaphoreCount = 1;
+                presentInfo.pWaitSemaphores = signalSemaphores;
 
-            VkSwapchainKHR swapChains[] = {swapChain};
-            presentInfo.swapchainCount = 1;
-            presentInfo.pSwapchains = swapChains;
+                VkSwapchainKHR swapChains[] = {swapChain};
+                presentInfo.swapchainCount = 1;
+                presentInfo.pSwapchains = swapChains;
 
-            presentInfo.pImageIndices = &imageIndex;
+                presentInfo.pImageIndices = &imageIndex;
 
-            result = vkQueuePresentKHR(presentQueue, &presentInfo);
+                result = vkQueuePresentKHR(presentQueue, &presentInfo);
+            }
+            collectLatency(false);
+
+            auto frameEnd = std::chrono::high_resolution_clock::now();
+            frameTimings.add(std::chrono::duration<double, std::milli>(frameEnd - frameStart).count());
+            if (lastPresentTime != std::chrono::high_resolution_clock::time_point{}) {
+                double interval = std::chrono::duration<double, std::milli>(frameEnd - lastPresentTime).count();
+                (frameEnd < interactionEnd ? interactionPacing : framePacing).add(interval);
+                presentModeIntervals[swapChainPresentMode].add(interval);
+            }
+            lastPresentTime = frameEnd;
+            if (measuringBenchmark) {
+                benchmarkCpuFrame.add(std::chrono::duration<double, std::milli>(frameEnd - frameStart).count());
+                benchmarkFenceWait.add(fenceWait);
+            }
 
-            if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
+            if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized || presentModeChanged) {
                 framebufferResized = false;
+                presentModeChanged = false;
                 recreateSwapChain();
             } else if (result != VK_SUCCESS) {
                 throw std::runtime_error("failed to present swap chain image!");
             }
 
-            currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+            currentFrame = (currentFrame + 1) % settings.framesInFlight;
         }
 
 
         //wrap shader binary into VkShaderModule
-        VkShaderModule createShaderModule(const std::vector<char>& code) {
+        VkShaderModule createShaderModule(const uint32_t* code, size_t codeSize) {
             VkShaderModuleCreateInfo createInfo{};
             createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-            createInfo.codeSize = code.size();
-            createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+            createInfo.codeSize = codeSize;
+            createInfo.pCode = code;
 
             VkShaderModule shaderModule;
             if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
@@ -1528,11 +5928,11 @@ class HelloTriangleApplication {
         }
 
 
-        //prefer VK_PRESENT_MODE_MAILBOX_KHR present mode if available, otherwise pick VK_PRESENT_MODE_FIFO_KHR (always available)
+        //first mode of the --present-mode policy the surface supports, VK_PRESENT_MODE_FIFO_KHR is always available
         VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
-            for (const auto& availablePresentMode : availablePresentModes) {
-                if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-                    return availablePresentMode;
+            for (VkPresentModeKHR presentMode : presentModePreference(settings.presentPolicy)) {
+                if (std::find(availablePresentModes.begin(), availablePresentModes.end(), presentMode) != availablePresentModes.end()) {
+                    return presentMode;
                 }
             }
 
@@ -1544,12 +5944,9 @@ class HelloTriangleApplication {
             if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
                 return capabilities.currentExtent;
             } else {
-                int width, height;
-                glfwGetFramebufferSize(window, &width, &height);
-
                 VkExtent2D actualExtent = {
-                    static_cast<uint32_t>(width),
-                    static_cast<uint32_t>(height)
+                    static_cast<uint32_t>(framebufferWidth),
+                    static_cast<uint32_t>(framebufferHeight)
                 };
 
                 actualExtent.width = std::clamp(actualExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
@@ -1590,8 +5987,8 @@ class HelloTriangleApplication {
 
             bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-            bool swapChainAdequate = false;
-            if (extensionsSupported) {
+            bool swapChainAdequate = settings.headless;
+            if (extensionsSupported && !settings.headless) {
                 SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
                 swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
             }
@@ -1602,7 +5999,28 @@ class HelloTriangleApplication {
             return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
         }
 
-        //looks through extension support of the VkPhysicalDevice and returns true if every extension in deviceExtensions is found
+        //deviceExtensions, headless runs present nothing and need none of them
+        std::vector<const char*> requiredDeviceExtensions() {
+            return settings.headless ? std::vector<const char*>{} : deviceExtensions;
+        }
+
+        //optional extensions are enabled only when the device lists them
+        bool deviceSupportsExtension(VkPhysicalDevice device, const char* name) {
+            uint32_t extensionCount;
+            vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+            std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+            vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+            for (const auto& extension : availableExtensions) {
+                if (strcmp(extension.extensionName, name) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        //looks through extension support of the VkPhysicalDevice and returns true if every extension in requiredDeviceExtensions is found
         bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
             uint32_t extensionCount;
             vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
@@ -1610,7 +6028,8 @@ class HelloTriangleApplication {
             std::vector<VkExtensionProperties> availableExtensions(extensionCount);
             vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-            std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+            std::vector<const char*> extensions = requiredDeviceExtensions();
+            std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 
             for (const auto& extension : availableExtensions) {
                 requiredExtensions.erase(extension.extensionName);
@@ -1638,8 +6057,13 @@ class HelloTriangleApplication {
                     indices.graphicsFamily = i;
                 }
 
+                //headless runs never present, the graphics queue stands in for the present queue
                 VkBool32 presentSupport = false;
-                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+                if (settings.headless) {
+                    presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+                } else {
+                    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+                }
 
                 if (presentSupport) {
                     indices.presentFamily = i;
@@ -1655,13 +6079,16 @@ class HelloTriangleApplication {
             return indices;
         }
 
-        //get required GLFW extensions and extensions needed for VkDebugUtilsMessengerEXT if we're debugging
+        //get required GLFW extensions (none when headless) and extensions needed for VkDebugUtilsMessengerEXT if we're debugging
         std::vector<const char*> getRequiredExtensions() {
-            uint32_t glfwExtensionCount = 0;
-            const char** glfwExtensions;
-            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+            std::vector<const char*> extensions;
+            if (!settings.headless) {
+                uint32_t glfwExtensionCount = 0;
+                const char** glfwExtensions;
+                glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-            std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+                extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+            }
 
             if (enableValidationLayers) {
                 extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -1696,25 +6123,6 @@ class HelloTriangleApplication {
             return true;
         }
 
-        //read and return buffer with compiled shaders
-        static std::vector<char> readFile(const std::string& filename) {
-            std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-            if (!file.is_open()) {
-                throw std::runtime_error("failed to open file!");
-            }
-
-            size_t fileSize = (size_t) file.tellg();
-            std::vector<char> buffer(fileSize);
-
-            file.seekg(0);
-            file.read(buffer.data(), fileSize);
-
-            file.close();
-
-            return buffer;
-        }
-
         //callback function to validation layer error messages
         static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
             VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -1729,10 +6137,9 @@ class HelloTriangleApplication {
 };
 
 
-int main() {
-    HelloTriangleApplication app;
-
+int main(int argc, char* argv[]) {
     try {
+        HelloTriangleApplication app(parseArguments(argc, argv));
         app.run();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -1,3 +0,0 @@
-C:/VulkanSDK/1.3.290.0/Bin/glslc.exe shader.vert -o vert.spv
-C:/VulkanSDK/1.3.290.0/Bin/glslc.exe shader.frag -o frag.spv
-pause
\ No newline at end of file
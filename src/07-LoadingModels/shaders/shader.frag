@@ -1,5 +1,18 @@
 #version 450
 
+//quality tier, set per pipeline through VkSpecializationInfo so disabled features are compiled out
+layout(constant_id = 0) const bool USE_TEXTURE = true;
+layout(constant_id = 1) const bool USE_VERTEX_COLOR = false;
+//read the tier from ubo.featureFlags at runtime instead, only used to compare against the specialised variants
+layout(constant_id = 2) const bool DYNAMIC_FEATURES = false;
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+    uint featureFlags;
+} ubo;
+
 layout(binding = 1) uniform sampler2D texSampler;
 
 layout(location = 0) in vec3 fragColor;
@@ -8,5 +21,12 @@ layout(location = 1) in vec2 fragTexCoord;
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
+    bool useTexture = DYNAMIC_FEATURES ? (ubo.featureFlags & 1u) != 0u : USE_TEXTURE;
+    bool useVertexColor = DYNAMIC_FEATURES ? (ubo.featureFlags & 2u) != 0u : USE_VERTEX_COLOR;
+
+    vec4 color = useTexture ? texture(texSampler, fragTexCoord) : vec4(1.0);
+    if (useVertexColor) {
+        color.rgb *= fragColor;
+    }
+    outColor = color;
 }
\ No newline at end of file
@@ -1,11 +1,23 @@
 #version 450
 
 layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
     mat4 view;
     mat4 proj;
+    mat4 viewProj;
+    uint featureFlags;
 } ubo;
 
+//per draw data, either pushed with every vkCmdDrawIndexed or sub-allocated from a uniform ring and bound with a dynamic offset
+layout(constant_id = 3) const bool MODEL_FROM_OBJECT_BUFFER = false;
+
+layout(push_constant) uniform PushConstants {
+    mat4 model;
+} push;
+
+layout(binding = 2) uniform ObjectData {
+    mat4 model;
+} object;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
@@ -14,7 +26,8 @@ layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    mat4 model = MODEL_FROM_OBJECT_BUFFER ? object.model : push.model;
+    gl_Position = ubo.viewProj * model * vec4(inPosition, 1.0);
     fragColor = inColor;
     fragTexCoord = inTexCoord;
 }
\ No newline at end of file